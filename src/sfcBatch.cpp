@@ -0,0 +1,346 @@
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "sfcBatch.hpp"
+#include "sfcFile.hpp"
+#include "sfcTasks.hpp"
+#include "sfcUring.hpp"
+
+using namespace std;
+
+// What an image read without keeping it in memory takes: the read buffer and its header windows
+const size_t streamMemory = 0x400000 + 0x20000;
+
+// Adaptive runs look at windows of at least this long, and enough files to have kept every active thread busy
+const double adaptWindow = 0.25;
+
+// Sets how many of the pool's threads check images at once, from what the files of the last window spent their
+// time on: runs bound by computing use every available core, ones waiting on reads try more or fewer threads
+// and keep going whichever way moves more bytes per second
+struct sfcConcurrency {
+    sfcConcurrency(sfcTaskPool& pool, unsigned cores);
+
+    // Account for a checked file and the wall and CPU seconds its task took
+    void finished(uint64_t bytes, double wall, double cpu);
+
+  private:
+    sfcTaskPool& pool;
+    unsigned cores;
+    int direction = 1;
+    double lastRate = 0;
+
+    chrono::steady_clock::time_point windowStart;
+    uint64_t windowBytes = 0;
+    size_t windowFiles = 0;
+    double windowWall = 0;
+    double windowCpu = 0;
+};
+
+vector<size_t> diskOrder(const vector<string>& paths, vector<uint64_t>& sizes);
+
+bool isImagePath(const string& path) {
+    string extension = filesystem::path(path).extension().string();
+    transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)tolower(c); });
+    for (auto known : {".sfc", ".smc", ".swc", ".fig", ".zip", ".zst"}) {
+        if (extension == known) { return true; }
+    }
+    return false;
+}
+
+vector<string> findImages(const vector<string>& paths, sfcTaskPool* pool, vector<string>* names) {
+    vector<string> images;
+    mutex lock;
+    for (const auto& path : paths) {
+        error_code ec;
+        if (!filesystem::is_directory(path, ec)) {
+            images.push_back(path);
+            if (names) { names->push_back(filesystem::path(path).generic_string()); }
+            continue;
+        }
+
+        // Every directory is listed by its own task, subdirectories are spread over the pool
+        vector<string> found;
+        sfcTaskGroup walks(pool);
+        function<void(const filesystem::path&)> walk = [&](const filesystem::path& directory) {
+            vector<string> files;
+            error_code ec;
+            for (auto it = filesystem::directory_iterator(directory, ec); !ec && it != filesystem::directory_iterator();
+                 it.increment(ec)) {
+                error_code entryError;
+                if (it->is_directory(entryError) && !it->is_symlink(entryError)) {
+                    walks.run([&walk, subdirectory = it->path()] { walk(subdirectory); });
+                } else if (it->is_regular_file(entryError) && isImagePath(it->path().string())) {
+                    files.push_back(it->path().string());
+                }
+            }
+            lock_guard<mutex> guard(lock);
+            found.insert(found.end(), files.begin(), files.end());
+        };
+        walk(path);
+        walks.wait();
+
+        sort(found.begin(), found.end());
+        images.insert(images.end(), found.begin(), found.end());
+        if (names) {
+            for (const auto& image : found) {
+                names->push_back(filesystem::path(image).lexically_relative(path).generic_string());
+            }
+        }
+    }
+    return images;
+}
+
+bool inShard(const string& name, unsigned shard, unsigned count) {
+    // 64 bit FNV-1a
+    uint64_t hash = 0xcbf29ce484222325;
+    for (unsigned char c : name) {
+        hash = (hash ^ c) * 0x100000001b3;
+    }
+    return hash % count == shard;
+}
+
+void runBatch(
+    const vector<string>& paths, sfcTaskPool& pool, const sfcBatchOptions& options, const sfcBatchTask& task,
+    const function<void(const sfcResult& result)>& output
+) {
+    unsigned jobs = pool.size();
+    vector<uint64_t> sizes;
+    vector<size_t> order = diskOrder(paths, sizes);
+    if (jobs > 1) {
+        // Biggest files first so no job is left with a large image at the end, but only by size class (up to 1MB,
+        // 2MB, 4MB, 8MB, 16MB...): within a class files stay in disk order, so reading mostly still sweeps forward
+        auto sizeClass = [&](size_t index) { return bit_width((sizes[index] - (sizes[index] > 0)) >> 20); };
+        stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sizeClass(a) > sizeClass(b); });
+    }
+
+    vector<sfcResult> results(paths.size());
+    vector<bool> finished(paths.size());
+    mutex lock;
+    condition_variable ready;
+
+    auto report = [&](size_t index, sfcResult&& result) {
+        lock_guard<mutex> guard(lock);
+        results[index] = std::move(result);
+        finished[index] = true;
+        ready.notify_all();
+    };
+
+    // Under a memory budget, files bigger than a job's share are streamed rather than held in memory, and a file is
+    // only started once what it needs fits next to the files in flight (or when nothing else is, however big it is)
+    size_t budget = options.maxMemory;
+    size_t inUse = 0;
+    auto streamedSize = [&](uint64_t size) { return budget && size > budget / jobs && size > streamMemory; };
+    auto streamed = [&](size_t index) { return streamedSize(sizes[index]); };
+    auto cost = [&](size_t index) { return !budget ? 0 : streamed(index) ? streamMemory : (size_t)sizes[index]; };
+
+    // Buffers left over once an image is checked are reused for later files (retained images keep theirs)
+    vector<sfcBytes> spareBuffers;
+    size_t spareBytes = 0;
+
+    // Spare buffers are given up before waiting for memory
+    auto fits = [&](size_t index) {
+        if (!budget || inUse == 0) { return true; }
+        if (inUse + spareBytes + cost(index) > budget) {
+            spareBuffers.clear();
+            spareBytes = 0;
+        }
+        return inUse + cost(index) <= budget;
+    };
+    condition_variable room;
+
+    // Called with the lock held once a file's image is checked
+    auto release = [&](size_t index, sfcBytes&& content) {
+        inUse -= cost(index);
+        size_t capacity = content.capacity();
+        if (capacity && spareBuffers.size() < pool.activeCount() * 4 && (!budget || inUse + spareBytes + capacity <= budget)) {
+            spareBuffers.push_back(std::move(content));
+            spareBytes += capacity;
+        }
+        room.notify_all();
+    };
+
+    // Files are read ahead of the tasks checking them, at most a few per active thread, so reading the next files
+    // overlaps with checking the current ones. io_uring keeps many reads in flight for any number of jobs; without
+    // it a single loader thread only pays off for a single job, otherwise every task reads its own file.
+    bool preload = options.preload && (uringAvailable() || jobs == 1);
+    size_t admitted = 0;
+    sfcTaskGroup files(&pool);
+
+    unique_ptr<sfcConcurrency> concurrency;
+    if (options.adaptive) { concurrency = make_unique<sfcConcurrency>(pool, availableCores()); }
+
+    unique_ptr<sfcRateLimiter> limiter;
+    if (options.ioLimit > 0) { limiter = make_unique<sfcRateLimiter>(options.ioLimit); }
+
+    sfcLoadCallbacks callbacks;
+    // A file found admissible can stop being so while the limiter is waited on (adaptive concurrency lowers the
+    // active thread count as tasks finish), so it's checked again when committing, and a waiting admit tries again.
+    // Its bytes are only charged to the limiter once it's admitted.
+    callbacks.admit = [&](size_t index, bool wait) {
+        auto admissible = [&] { return admitted < pool.activeCount() * 4 && fits(index); };
+        auto commit = [&] {
+            lock_guard<mutex> guard(lock);
+            if (!admissible()) { return false; }
+            ++admitted;
+            inUse += cost(index);
+            return true;
+        };
+        while (true) {
+            {
+                unique_lock<mutex> guard(lock);
+                if (wait) { room.wait(guard, admissible); }
+                if (!admissible()) { return false; }
+            }
+            if (limiter ? limiter->take(sizes[index], wait, commit) : commit()) { return true; }
+            if (!wait) { return false; }
+        }
+    };
+    callbacks.allocate = [&](size_t size) {
+        unique_lock<mutex> guard(lock);
+        if (streamedSize(size)) { return sfcBytes(); }
+        if (spareBuffers.empty()) {
+            guard.unlock();
+            return sfcBytes(size);
+        }
+        sfcBytes bytes = std::move(spareBuffers.back());
+        spareBuffers.pop_back();
+        spareBytes -= bytes.capacity();
+        guard.unlock();
+        bytes.resize(size);
+        return bytes;
+    };
+    callbacks.loaded = [&](size_t index, sfcBytes&& content) {
+        files.run([&, index, content = std::move(content)]() mutable {
+            auto start = chrono::steady_clock::now();
+            double startCpu = threadCpuSeconds();
+            sfcResult result = task(paths[index], std::move(content), streamed(index));
+            double wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            double cpu = threadCpuSeconds() - startCpu;
+
+            unique_lock<mutex> guard(lock);
+            release(index, std::move(content));
+            --admitted;
+            if (concurrency) { concurrency->finished(sizes[index], wall, cpu); }
+            guard.unlock();
+            report(index, std::move(result));
+        });
+    };
+
+    thread loader([&] {
+        if (preload) {
+            loadFiles(paths, order, options.keepCache, callbacks);
+            return;
+        }
+        for (size_t index : order) {
+            while (!callbacks.admit(index, true)) {}
+            callbacks.loaded(index, sfcBytes());
+        }
+    });
+
+    // Results are reported in the order of paths, whatever order they finish in
+    for (size_t i = 0; i < paths.size(); ++i) {
+        unique_lock<mutex> guard(lock);
+        ready.wait(guard, [&] { return finished[i]; });
+        sfcResult result = std::move(results[i]);
+        guard.unlock();
+        output(result);
+    }
+    loader.join();
+    files.wait();
+}
+
+sfcRateLimiter::sfcRateLimiter(double rate)
+    : rate(rate),
+      tokens(rate),
+      last(chrono::steady_clock::now()) {}
+
+bool sfcRateLimiter::take(uint64_t bytes, bool wait, const function<bool()>& admit) {
+    unique_lock<mutex> guard(lock);
+    while (true) {
+        auto now = chrono::steady_clock::now();
+        tokens = min(rate, tokens + chrono::duration<double>(now - last).count() * rate);
+        last = now;
+        if (tokens > 0) { break; }
+        if (!wait) { return false; }
+        guard.unlock();
+        this_thread::sleep_for(chrono::duration<double>(-tokens / rate + 0.001));
+        guard.lock();
+    }
+    if (admit && !admit()) { return false; }
+    tokens -= (double)bytes;
+    return true;
+}
+
+double sfcRateLimiter::available() {
+    lock_guard<mutex> guard(lock);
+    return tokens;
+}
+
+sfcConcurrency::sfcConcurrency(sfcTaskPool& pool, unsigned cores)
+    : pool(pool),
+      cores(cores),
+      windowStart(chrono::steady_clock::now()) {
+    pool.setActive(cores);
+}
+
+void sfcConcurrency::finished(uint64_t bytes, double wall, double cpu) {
+    windowBytes += bytes;
+    windowWall += wall;
+    windowCpu += cpu;
+    ++windowFiles;
+
+    auto now = chrono::steady_clock::now();
+    double elapsed = chrono::duration<double>(now - windowStart).count();
+    unsigned active = pool.activeCount();
+    if (elapsed < adaptWindow || windowFiles < active) { return; }
+
+    double rate = windowBytes / elapsed;
+    unsigned next = active;
+    // Threads that wait for a core don't add CPU time, so compare against what the cores in use could have done
+    bool computeBound = windowCpu > windowWall * 0.75 || windowCpu > elapsed * min(active, cores) * 0.75;
+    if (computeBound) {
+        // More threads than cores would only take turns
+        next = cores;
+    } else {
+        if (rate < lastRate) { direction = -direction; }
+        unsigned step = max(1u, active / 4);
+        next = direction > 0 ? active + step : active - min(active - 1, step);
+    }
+    lastRate = rate;
+    pool.setActive(next);
+
+    windowStart = now;
+    windowBytes = 0;
+    windowFiles = 0;
+    windowWall = 0;
+    windowCpu = 0;
+}
+
+// Indices of paths sorted by where their data starts on disk, noting the size of each file on the way
+vector<size_t> diskOrder(const vector<string>& paths, vector<uint64_t>& sizes) {
+    vector<pair<uint64_t, size_t>> locations;
+    sizes.assign(paths.size(), 0);
+    for (size_t i = 0; i < paths.size(); ++i) {
+        sfcFile file(paths[i]);
+        if (file.isOpen()) { sizes[i] = file.size(); }
+        locations.emplace_back(file.isOpen() ? file.physicalOffset() : 0, i);
+    }
+    stable_sort(locations.begin(), locations.end());
+
+    vector<size_t> order;
+    for (auto [location, index] : locations) {
+        order.push_back(index);
+    }
+    return order;
+}
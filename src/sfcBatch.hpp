@@ -0,0 +1,65 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "sfcImage.hpp"
+#include "sfcResult.hpp"
+#include "sfcTasks.hpp"
+
+struct sfcBatchOptions {
+    bool preload = true;    // Read plain files ahead on one loader thread (io_uring where available)
+    bool keepCache = true;  // Leave preloaded files in the page cache
+    size_t maxMemory = 0;   // Approximate bound on memory for images in flight in bytes, 0 for none
+    bool adaptive = false;  // Vary how many of the pool's threads check images at once by what limits throughput
+    double ioLimit = 0;     // Average bytes read per second, 0 for no limit
+};
+
+// Checks one image: gets the file's content when it was preloaded, or no bytes to read the file itself
+// (archives, anything that couldn't be preloaded, or without preloading), in which case `stream` asks for
+// reading it without keeping the image in memory. Returns the result for it.
+using sfcBatchTask = std::function<sfcResult(const std::string& path, sfcBytes&& content, bool stream)>;
+
+// Does path have the extension of a ROM image file (or an archive holding one)?
+bool isImagePath(const std::string& path);
+
+// ROM image files among paths: files as given, directories searched recursively by ROM image extension
+// (listed in parallel on pool if given). `names` gets each one's path relative to the directory it was found in.
+std::vector<std::string> findImages(
+    const std::vector<std::string>& paths, sfcTaskPool* pool = nullptr, std::vector<std::string>* names = nullptr
+);
+
+// Does the image named `name` (as found by findImages) belong to shard `shard` of `count` (from 0)?
+// Stable across machines and runs, so separate runs over the same collection cover every image exactly once.
+bool inShard(const std::string& name, unsigned shard, unsigned count);
+
+// Run task for every path as tasks on pool, one image per thread in parallel, starting files in on-disk order so
+// spinning disks read sequentially (biggest size class first with several threads, to finish together), and hand each
+// result to output on the calling thread in the order of paths
+void runBatch(
+    const std::vector<std::string>& paths, sfcTaskPool& pool, const sfcBatchOptions& options, const sfcBatchTask& task,
+    const std::function<void(const sfcResult& result)>& output
+);
+
+// Token bucket keeping reads to `rate` bytes per second on average, with bursts of up to a second's worth
+// A read bigger than that still goes ahead once the bucket isn't in debt, and later ones wait it off
+struct sfcRateLimiter {
+    explicit sfcRateLimiter(double rate);
+
+    // Account for `bytes` about to be read, false while earlier reads are ahead of the rate (unless told to wait)
+    // or if `admit`, asked once the rate allows the read, turns it down. Only reads that go ahead are charged.
+    bool take(uint64_t bytes, bool wait, const std::function<bool()>& admit = nullptr);
+
+    // Bytes that can be read without waiting, as of the last take (negative while in debt)
+    double available();
+
+  private:
+    std::mutex lock;
+    double rate;
+    double tokens;
+    std::chrono::steady_clock::time_point last;
+};
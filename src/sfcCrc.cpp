@@ -0,0 +1,92 @@
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "sfcCrc.hpp"
+
+using namespace std;
+
+// Slicing-by-8 lookup tables
+static const array<array<uint32_t, 256>, 8> crcTables = [] {
+    array<array<uint32_t, 256>, 8> tables = {};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        }
+        tables[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (size_t t = 1; t < 8; ++t) {
+            tables[t][i] = (tables[t - 1][i] >> 8) ^ tables[0][tables[t - 1][i] & 0xff];
+        }
+    }
+    return tables;
+}();
+
+uint32_t crc32(const uint8_t* data, size_t length, uint32_t crc) {
+    const auto& t = crcTables;
+    crc = ~crc;
+
+    while (length >= 8) {
+        uint32_t lo = (data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24)) ^ crc;
+        uint32_t hi = data[4] | (data[5] << 8) | (data[6] << 16) | ((uint32_t)data[7] << 24);
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^ t[3][hi & 0xff] ^
+              t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+        data += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc = t[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Multiply vector by 32x32 matrix over GF(2)
+static uint32_t gf2Times(const array<uint32_t, 32>& matrix, uint32_t vector) {
+    uint32_t sum = 0;
+    for (size_t i = 0; vector; ++i, vector >>= 1) {
+        if (vector & 1) { sum ^= matrix[i]; }
+    }
+    return sum;
+}
+
+static array<uint32_t, 32> gf2Square(const array<uint32_t, 32>& matrix) {
+    array<uint32_t, 32> square;
+    for (size_t i = 0; i < 32; ++i) {
+        square[i] = gf2Times(matrix, matrix[i]);
+    }
+    return square;
+}
+
+uint32_t crc32Zeros(size_t length, uint32_t crc) {
+    return sfcCrcZeros(length)(crc);
+}
+
+sfcCrcZeros::sfcCrcZeros(size_t length) {
+    // Operator for one zero bit, squared up to one zero byte, then multiplied in per set bit of length
+    array<uint32_t, 32> power;
+    power[0] = 0xedb88320;
+    for (size_t i = 1; i < 32; ++i) {
+        power[i] = 1u << (i - 1);
+        matrix[i] = 1u << i;
+    }
+    matrix[0] = 1;
+    for (int i = 0; i < 3; ++i) {
+        power = gf2Square(power);
+    }
+
+    while (length) {
+        if (length & 1) {
+            for (auto& column : matrix) {
+                column = gf2Times(power, column);
+            }
+        }
+        length >>= 1;
+        if (length) { power = gf2Square(power); }
+    }
+}
+
+uint32_t sfcCrcZeros::operator()(uint32_t crc) const {
+    return ~gf2Times(matrix, ~crc);
+}
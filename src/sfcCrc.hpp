@@ -0,0 +1,21 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32 (ISO-HDLC, as used by zip, IPS/BPS tooling etc.)
+// Pass the previous result as `crc` to continue a running checksum.
+uint32_t crc32(const uint8_t* data, size_t length, uint32_t crc = 0);
+
+// Continue a running checksum over `length` zero bytes without touching any memory (O(log length))
+uint32_t crc32Zeros(size_t length, uint32_t crc = 0);
+
+// crc32Zeros for a fixed length, set up once so each use is a single matrix product (eg. once per bank)
+struct sfcCrcZeros {
+    explicit sfcCrcZeros(size_t length);
+    uint32_t operator()(uint32_t crc = 0) const;
+
+  private:
+    std::array<uint32_t, 32> matrix;
+};
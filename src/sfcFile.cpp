@@ -0,0 +1,326 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+    #include <io.h>
+    #include <stdio.h>
+#else
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+#ifdef __linux__
+    #include <linux/fiemap.h>
+    #include <linux/fs.h>
+    #include <sys/ioctl.h>
+#endif
+
+#include "sfcFile.hpp"
+
+using namespace std;
+
+constexpr size_t skipChunkSize = 0x100000;
+constexpr size_t writeChunkSize = 0x100000;
+
+// Thin platform layer
+#ifdef _WIN32
+static int openFile(const char* path) { return _open(path, _O_RDONLY | _O_BINARY); }
+
+static int createFile(const char* path) {
+    return _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+}
+
+static int updateFile(const char* path) { return _open(path, _O_RDWR | _O_BINARY); }
+
+static int closeFile(int fd) { return _close(fd); }
+
+static int64_t readFile(int fd, uint8_t* buffer, size_t length) { return _read(fd, buffer, (unsigned int)length); }
+
+static int64_t writeFile(int fd, const uint8_t* buffer, size_t length) { return _write(fd, buffer, (unsigned int)length); }
+
+static int64_t readFileAt(int fd, uint8_t* buffer, size_t length, uint64_t offset) {
+    // No pread, so restore the position afterwards
+    int64_t position = _lseeki64(fd, 0, SEEK_CUR);
+    if (_lseeki64(fd, (int64_t)offset, SEEK_SET) < 0) { return -1; }
+    int64_t result = _read(fd, buffer, (unsigned int)length);
+    _lseeki64(fd, position, SEEK_SET);
+    return result;
+}
+
+static int64_t writeFileAt(int fd, const uint8_t* buffer, size_t length, uint64_t offset) {
+    int64_t position = _lseeki64(fd, 0, SEEK_CUR);
+    if (_lseeki64(fd, (int64_t)offset, SEEK_SET) < 0) { return -1; }
+    int64_t result = _write(fd, buffer, (unsigned int)length);
+    _lseeki64(fd, position, SEEK_SET);
+    return result;
+}
+
+static bool truncateFile(int fd, uint64_t size) { return _chsize_s(fd, (int64_t)size) == 0; }
+
+static bool syncFile(int fd) { return _commit(fd) == 0; }
+
+static pair<uint64_t, uint64_t> findData(int, uint64_t offset, uint64_t size) { return {offset, size}; }
+
+static uint64_t firstPhysical(int) { return 0; }
+
+static void adviseFile(int, sfcFileAdvice, uint64_t, uint64_t) {}
+
+static vector<uint8_t> pageResidency(int, uint64_t) { return {}; }
+
+static size_t pageSize() { return 0x1000; }
+
+static size_t regularFileSize(int fd) {
+    struct _stat64 info = {};
+    if (_fstat64(fd, &info) != 0 || (info.st_mode & _S_IFMT) != _S_IFREG) { return 0; }
+    return (size_t)info.st_size;
+}
+#else
+static int openFile(const char* path) { return ::open(path, O_RDONLY); }
+
+static int createFile(const char* path) { return ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666); }
+
+static int updateFile(const char* path) { return ::open(path, O_RDWR); }
+
+static int closeFile(int fd) { return ::close(fd); }
+
+static int64_t readFile(int fd, uint8_t* buffer, size_t length) { return ::read(fd, buffer, length); }
+
+static int64_t writeFile(int fd, const uint8_t* buffer, size_t length) { return ::write(fd, buffer, length); }
+
+static int64_t readFileAt(int fd, uint8_t* buffer, size_t length, uint64_t offset) {
+    return ::pread(fd, buffer, length, (off_t)offset);
+}
+
+static int64_t writeFileAt(int fd, const uint8_t* buffer, size_t length, uint64_t offset) {
+    return ::pwrite(fd, buffer, length, (off_t)offset);
+}
+
+static bool truncateFile(int fd, uint64_t size) { return ::ftruncate(fd, (off_t)size) == 0; }
+
+static bool syncFile(int fd) {
+#ifdef __APPLE__
+    return ::fsync(fd) == 0;
+#else
+    return ::fdatasync(fd) == 0;
+#endif
+}
+
+static pair<uint64_t, uint64_t> findData(int fd, uint64_t offset, uint64_t size) {
+#ifdef SEEK_DATA
+    // Fails with ENXIO past the last data, other failures (no hole support) leave the rest as data
+    off_t position = ::lseek(fd, 0, SEEK_CUR);
+    off_t begin = ::lseek(fd, (off_t)offset, SEEK_DATA);
+    bool noData = begin < 0 && errno == ENXIO;
+    off_t end = begin < 0 ? -1 : ::lseek(fd, begin, SEEK_HOLE);
+    ::lseek(fd, position, SEEK_SET);
+    if (begin < 0) { return noData ? make_pair(size, size) : make_pair(offset, size); }
+    return {(uint64_t)begin, end < 0 ? size : min((uint64_t)end, size)};
+#else
+    return {offset, size};
+#endif
+}
+
+static void adviseFile(int fd, sfcFileAdvice advice, uint64_t offset, uint64_t length) {
+#ifdef POSIX_FADV_SEQUENTIAL
+    int pattern = POSIX_FADV_SEQUENTIAL;
+    if (advice == sfcFileAdvice::willNeed) { pattern = POSIX_FADV_WILLNEED; }
+    if (advice == sfcFileAdvice::dontNeed) { pattern = POSIX_FADV_DONTNEED; }
+    ::posix_fadvise(fd, (off_t)offset, (off_t)length, pattern);
+#endif
+}
+
+static size_t pageSize() { return (size_t)::sysconf(_SC_PAGESIZE); }
+
+// Mapping a file doesn't read it, and mincore then tells which pages the page cache holds
+// (Linux only reports that for files the caller could write, otherwise pages look uncached)
+static vector<uint8_t> pageResidency(int fd, uint64_t size) {
+    if (size == 0) { return {}; }
+    void* map = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) { return {}; }
+    vector<uint8_t> pages((size + pageSize() - 1) / pageSize());
+#ifdef __APPLE__
+    bool known = ::mincore(map, size, reinterpret_cast<char*>(pages.data())) == 0;
+#else
+    bool known = ::mincore(map, size, pages.data()) == 0;
+#endif
+    ::munmap(map, size);
+    return known ? pages : vector<uint8_t>();
+}
+
+static uint64_t firstPhysical(int fd) {
+#ifdef __linux__
+    alignas(struct fiemap) uint8_t request[sizeof(struct fiemap) + sizeof(struct fiemap_extent)] = {};
+    auto* map = reinterpret_cast<struct fiemap*>(request);
+    map->fm_length = FIEMAP_MAX_OFFSET;
+    map->fm_extent_count = 1;
+    if (::ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents == 1) { return map->fm_extents[0].fe_physical; }
+#endif
+    struct stat info = {};
+    return ::fstat(fd, &info) == 0 ? (uint64_t)info.st_ino : 0;
+}
+
+static size_t regularFileSize(int fd) {
+    struct stat info = {};
+    if (::fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) { return 0; }
+    return (size_t)info.st_size;
+}
+#endif
+
+sfcFile::sfcFile(const string& path, sfcFileMode mode) {
+    bool write = mode != sfcFileMode::read;
+    if (path == "-") {
+#ifdef _WIN32
+        _setmode(_fileno(write ? stdout : stdin), _O_BINARY);
+#endif
+        fd = write ? 1 : 0;
+        return;
+    }
+    switch (mode) {
+    case sfcFileMode::create:
+        fd = createFile(path.c_str());
+        break;
+    case sfcFileMode::update:
+        fd = updateFile(path.c_str());
+        break;
+    default:
+        fd = openFile(path.c_str());
+        break;
+    }
+    ownsFd = fd >= 0;
+}
+
+sfcFile::~sfcFile() {
+    if (ownsFd) { closeFile(fd); }
+}
+
+sfcFile::sfcFile(sfcFile&& other) noexcept
+    : fd(other.fd),
+      ownsFd(other.ownsFd) {
+    other.fd = -1;
+    other.ownsFd = false;
+}
+
+sfcFile& sfcFile::operator=(sfcFile&& other) noexcept {
+    if (this != &other) {
+        if (ownsFd) { closeFile(fd); }
+        fd = other.fd;
+        ownsFd = other.ownsFd;
+        other.fd = -1;
+        other.ownsFd = false;
+    }
+    return *this;
+}
+
+size_t sfcFile::size() const {
+    return fd >= 0 ? regularFileSize(fd) : 0;
+}
+
+size_t sfcFile::read(uint8_t* buffer, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        // Windows reads take an unsigned int length
+        size_t chunk = min(length - done, (size_t)0x40000000);
+        int64_t result = readFile(fd, buffer + done, chunk);
+        if (result <= 0) { break; }
+        done += (size_t)result;
+    }
+    return done;
+}
+
+size_t sfcFile::readAt(uint64_t offset, uint8_t* buffer, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        size_t chunk = min(length - done, (size_t)0x40000000);
+        int64_t result = readFileAt(fd, buffer + done, chunk, offset + done);
+        if (result <= 0) { break; }
+        done += (size_t)result;
+    }
+    return done;
+}
+
+bool sfcFile::write(const uint8_t* buffer, size_t length) {
+    while (length) {
+        int64_t result = writeFile(fd, buffer, min(length, writeChunkSize));
+        if (result <= 0) { return false; }
+        buffer += result;
+        length -= (size_t)result;
+    }
+    return true;
+}
+
+void sfcFile::advise(sfcFileAdvice advice, uint64_t offset, uint64_t length) {
+    if (fd >= 0) { adviseFile(fd, advice, offset, length); }
+}
+
+vector<uint8_t> residentPages(int fd, uint64_t size) {
+    return fd >= 0 ? pageResidency(fd, size) : vector<uint8_t>();
+}
+
+void dropPages(int fd, const vector<uint8_t>& resident) {
+    if (fd < 0) { return; }
+    if (resident.empty()) {
+        adviseFile(fd, sfcFileAdvice::dontNeed, 0, 0);
+        return;
+    }
+    // Drop each run of pages that weren't cached, keeping the ones something else had read already
+    uint64_t page = pageSize();
+    for (size_t begin = 0; begin < resident.size();) {
+        if (resident[begin] & 1) {
+            ++begin;
+            continue;
+        }
+        size_t end = begin;
+        while (end < resident.size() && !(resident[end] & 1)) {
+            ++end;
+        }
+        adviseFile(fd, sfcFileAdvice::dontNeed, begin * page, end == resident.size() ? 0 : (end - begin) * page);
+        begin = end;
+    }
+}
+
+uint64_t sfcFile::physicalOffset() const {
+    return fd >= 0 ? firstPhysical(fd) : 0;
+}
+
+pair<uint64_t, uint64_t> sfcFile::dataExtent(uint64_t offset) const {
+    uint64_t end = size();
+    if (offset >= end) { return {end, end}; }
+    auto extent = findData(fd, offset, end);
+    return {min(extent.first, end), extent.second};
+}
+
+bool sfcFile::writeAt(uint64_t offset, const uint8_t* buffer, size_t length) {
+    while (length) {
+        int64_t result = writeFileAt(fd, buffer, min(length, writeChunkSize), offset);
+        if (result <= 0) { return false; }
+        buffer += result;
+        offset += (uint64_t)result;
+        length -= (size_t)result;
+    }
+    return true;
+}
+
+bool sfcFile::truncate(uint64_t size) {
+    return fd >= 0 && truncateFile(fd, size);
+}
+
+bool sfcFile::sync() {
+    return fd >= 0 && syncFile(fd);
+}
+
+bool sfcFile::skip(size_t length) {
+    vector<uint8_t> discard(min(length, skipChunkSize));
+    while (length) {
+        size_t chunk = min(length, discard.size());
+        if (read(discard.data(), chunk) != chunk) { return false; }
+        length -= chunk;
+    }
+    return true;
+}
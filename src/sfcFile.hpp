@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Page cache hints for a file's access pattern
+enum class sfcFileAdvice { sequential, willNeed, dontNeed };
+
+// How a file is opened: read only, created (or emptied) for writing, or updated in place
+enum class sfcFileMode { read, create, update };
+
+// Unbuffered file handle for large sequential reads and writes, "-" is stdin (or stdout for writing)
+struct sfcFile {
+    sfcFile() = default;
+    explicit sfcFile(const std::string& path, sfcFileMode mode = sfcFileMode::read);
+    ~sfcFile();
+
+    sfcFile(const sfcFile&) = delete;
+    sfcFile& operator=(const sfcFile&) = delete;
+    sfcFile(sfcFile&& other) noexcept;
+    sfcFile& operator=(sfcFile&& other) noexcept;
+
+    bool isOpen() const { return fd >= 0; }
+
+    // Size of a regular file, or 0 for pipes and other streams
+    size_t size() const;
+
+    // Read until length bytes are read or the file ends, returns bytes read
+    size_t read(uint8_t* buffer, size_t length);
+
+    // Write all of buffer in bounded chunks, returns false on failure
+    bool write(const uint8_t* buffer, size_t length);
+
+    // Skip forward by reading, so it works on pipes as well
+    bool skip(size_t length);
+
+    // Positional read of a regular file, doesn't move the read position
+    size_t readAt(uint64_t offset, uint8_t* buffer, size_t length);
+
+    // Next run of data at or after offset as (begin, end), skipping holes of a sparse file
+    // Where holes can't be queried the rest of the file is one run
+    std::pair<uint64_t, uint64_t> dataExtent(uint64_t offset) const;
+
+    // Hint the page cache about a range (length 0 for the rest of the file), ignored where unsupported
+    void advise(sfcFileAdvice advice, uint64_t offset = 0, uint64_t length = 0);
+
+    // Physical location of the file's first extent on its device (FIEMAP), for reading files in on-disk order
+    // Where extents can't be queried it is the inode number, which roughly follows allocation order
+    uint64_t physicalOffset() const;
+
+    // Positional write of a regular file opened for update, returns false on failure
+    bool writeAt(uint64_t offset, const uint8_t* buffer, size_t length);
+
+    // Cut a regular file off at size, without rewriting what is kept
+    bool truncate(uint64_t size);
+
+    // Make what was written so far durable (survives a crash or power loss), returns false on failure
+    bool sync();
+
+    int fd = -1;
+
+  private:
+    bool ownsFd = false;
+};
+
+// Which pages of an open regular file of size bytes the page cache holds (bit 0 of each), taken before reading
+// it so that dropPages only drops what the read brought in. Empty where that can't be told.
+std::vector<uint8_t> residentPages(int fd, uint64_t size);
+
+// Drop a file's pages from the page cache except those flagged in resident, or all of them if it's empty
+void dropPages(int fd, const std::vector<uint8_t>& resident);
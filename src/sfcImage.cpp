@@ -0,0 +1,309 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "sfcCrc.hpp"
+#include "sfcImage.hpp"
+#include "sfcTasks.hpp"
+
+using namespace std;
+
+constexpr size_t scratchSize = 0x400000;
+
+// Bank sums of a retained image are taken in chunks of this size as separate tasks
+constexpr size_t sumChunkSize = 0x100000;
+
+// Blocks are moved through a temporary of this size, small enough to stay in L1 cache
+constexpr size_t deinterleaveSliceSize = 0x1000;
+
+// Streams of unknown size are read up to one byte past the largest valid file
+constexpr size_t maxStreamSize = 0xc00000 + 0x200 + 1;
+
+// Running a CRC over a bank of zeros, the common case of crc32Zeros when streaming
+static const sfcCrcZeros bankZeros(sfcBankSize);
+
+uint8_t sfcImage::operator[](size_t offset) const {
+    const uint8_t* byte = locate(offset);
+    return byte ? *byte : 0;
+}
+
+void sfcImage::sumBanks() {
+    bankSums.assign((data.size() + sfcBankSize - 1) / sfcBankSize, 0);
+
+    // On a task pool, large images are summed in chunks that idle threads can take over
+    sfcTaskPool* pool = sfcTaskPool::current();
+    sfcTaskGroup chunks(pool && pool->size() > 1 ? pool : nullptr);
+    size_t chunkBanks = sumChunkSize / sfcBankSize;
+    for (size_t first = 0; first < bankSums.size(); first += chunkBanks) {
+        chunks.run([this, first, chunkBanks] {
+            for (size_t bank = first; bank < min(first + chunkBanks, bankSums.size()); ++bank) {
+                size_t offset = bank * sfcBankSize;
+                bankSums[bank] = byteSum(&data[offset], min(sfcBankSize, data.size() - offset));
+            }
+        });
+    }
+    chunks.wait();
+}
+
+void sfcImage::put(size_t offset, uint8_t value) {
+    uint8_t* byte = locate(offset);
+    if (!byte) { return; }
+    bankSums[offset / sfcBankSize] += value - *byte;
+    *byte = value;
+    bankCrcs.clear();
+}
+
+void sfcImage::assign(size_t offset, const uint8_t* bytes, size_t length) {
+    while (length) {
+        size_t bank = offset / sfcBankSize;
+        size_t chunk = min(length, (bank + 1) * sfcBankSize - offset);
+        bankSums[bank] += byteSum(bytes, chunk) - byteSum(&data[offset], chunk);
+        copy(bytes, bytes + chunk, data.begin() + offset);
+        offset += chunk;
+        bytes += chunk;
+        length -= chunk;
+    }
+}
+
+void sfcImage::resize(size_t size) {
+    size_t oldSize = data.size();
+    data.resize(size);
+    if (size > oldSize) { fill(data.begin() + oldSize, data.end(), 0); }
+    length = size;
+    bankSums.resize((size + sfcBankSize - 1) / sfcBankSize, 0);
+    if (size < oldSize && size % sfcBankSize) {
+        size_t bank = size / sfcBankSize;
+        bankSums[bank] = byteSum(&data[bank * sfcBankSize], size % sfcBankSize);
+    }
+}
+
+void sfcImage::deinterleave() {
+    size_t blocks = length / sfcBankSize;
+    auto source = [&](size_t block) { return interleavedOffset(block * sfcBankSize, length) / sfcBankSize; };
+
+    // Bank sums follow their blocks, header windows are split into blocks at their new offsets
+    vector<uint32_t> sums(blocks);
+    for (size_t block = 0; block < blocks; ++block) {
+        sums[block] = bankSums[source(block)];
+    }
+    bankSums = std::move(sums);
+    if (!bankCrcs.empty()) {
+        vector<uint32_t> crcs(blocks);
+        for (size_t block = 0; block < blocks; ++block) {
+            crcs[block] = bankCrcs[source(block)];
+        }
+        bankCrcs = std::move(crcs);
+    }
+
+    vector<sfcWindow> moved;
+    for (auto& window : windows) {
+        for (size_t offset = 0; offset < window.bytes.size(); offset += sfcBankSize) {
+            size_t physical = (window.offset + offset) / sfcBankSize;
+            size_t block = physical < blocks / 2 ? physical * 2 + 1 : (physical - blocks / 2) * 2;
+            auto begin = window.bytes.begin() + offset;
+            moved.push_back({block * sfcBankSize, vector<uint8_t>(begin, begin + min(sfcBankSize, window.bytes.size() - offset))});
+        }
+    }
+    windows = std::move(moved);
+    if (!retained()) { return; }
+
+    // Follow each cycle of the permutation, a slice at a time so each pass only touches a few cache lines per block
+    vector<bool> placed(blocks);
+    uint8_t slice[deinterleaveSliceSize];
+    for (size_t start = 0; start < blocks; ++start) {
+        if (placed[start] || source(start) == start) { continue; }
+        for (size_t offset = 0; offset < sfcBankSize; offset += deinterleaveSliceSize) {
+            copy_n(&data[start * sfcBankSize + offset], deinterleaveSliceSize, slice);
+            size_t block = start;
+            for (size_t next = source(block); next != start; block = next, next = source(block)) {
+                copy_n(&data[next * sfcBankSize + offset], deinterleaveSliceSize, &data[block * sfcBankSize + offset]);
+            }
+            copy_n(slice, deinterleaveSliceSize, &data[block * sfcBankSize + offset]);
+        }
+        for (size_t block = start; !placed[block]; block = source(block)) {
+            placed[block] = true;
+        }
+    }
+}
+
+uint64_t sfcImage::sum(size_t offset, size_t length) const {
+    uint64_t total = 0;
+    size_t end = offset + length;
+    while (offset < end) {
+        size_t bank = offset / sfcBankSize;
+        size_t bankEnd = min((bank + 1) * sfcBankSize, size());
+        if (offset == bank * sfcBankSize && end >= bankEnd) {
+            total += bankSums[bank];
+            offset = bankEnd;
+        } else {
+            size_t chunkEnd = min(end, bankEnd);
+            total += byteSum(&data[offset], chunkEnd - offset);
+            offset = chunkEnd;
+        }
+    }
+    return total;
+}
+
+uint8_t* sfcImage::locate(size_t offset) {
+    return const_cast<uint8_t*>(static_cast<const sfcImage*>(this)->locate(offset));
+}
+
+const uint8_t* sfcImage::locate(size_t offset) const {
+    if (offset < data.size()) { return &data[offset]; }
+    for (const auto& window : windows) {
+        if (offset >= window.offset && offset < window.offset + window.bytes.size()) {
+            return &window.bytes[offset - window.offset];
+        }
+    }
+    return nullptr;
+}
+
+sfcImageBuilder::sfcImageBuilder(size_t fileSize, bool retain)
+    : fileSize(fileSize),
+      retain(retain) {
+    if (fileSize == sfcUnknownSize) {
+        this->retain = true;
+        return;
+    }
+    if ((fileSize & 0x3ff) == 0x200) { headerSize = 0x200; }
+    image.copierHeader.resize(headerSize);
+    image.length = fileSize - headerSize;
+    image.bankSums.assign((image.length + sfcBankSize - 1) / sfcBankSize, 0);
+    if (retain) {
+        image.data.resize(image.length);
+    } else {
+        image.bankCrcs.assign(image.bankSums.size(), 0);
+        for (auto [offset, length] : sfcHeaderWindows) {
+            if (offset < image.length) { image.windows.push_back({offset, vector<uint8_t>(min(length, image.length - offset))}); }
+        }
+    }
+}
+
+uint8_t* sfcImageBuilder::buffer(size_t& length) {
+    if (fileSize == sfcUnknownSize) {
+        // Grow the image, copier header is split off once the size is known
+        length = min(length, maxStreamSize - received);
+        image.data.resize(received + length);
+        pending = image.data.data() + received;
+    } else if (received < headerSize) {
+        length = min(length, headerSize - received);
+        pending = &image.copierHeader[received];
+    } else if (retain) {
+        length = min(length, fileSize - received);
+        pending = image.data.data() + (received - headerSize);
+    } else {
+        // Only as big as the file needs, so small images don't pay for clearing a large buffer
+        length = min({length, fileSize - received, scratchSize});
+        if (scratch.size() < length) { scratch.resize(length); }
+        pending = scratch.data();
+    }
+    return pending;
+}
+
+void sfcImageBuilder::commit(size_t length) {
+    take(pending, length);
+}
+
+void sfcImageBuilder::take(const uint8_t* bytes, size_t length) {
+    if (received < headerSize) {
+        crc = crc32(bytes, length, crc);
+        received += length;
+        return;
+    }
+
+    size_t offset = received - headerSize;
+    received += length;
+    if (fileSize == sfcUnknownSize) {
+        image.data.resize(received);
+        image.length = received;
+        image.bankSums.resize((received + sfcBankSize - 1) / sfcBankSize, 0);
+    }
+
+    for (auto& window : image.windows) {
+        size_t begin = max(offset, window.offset);
+        size_t end = min(offset + length, window.offset + window.bytes.size());
+        if (begin < end) { copy(bytes + (begin - offset), bytes + (end - offset), &window.bytes[begin - window.offset]); }
+    }
+
+    while (length) {
+        size_t bank = offset / sfcBankSize;
+        size_t chunk = min(length, (bank + 1) * sfcBankSize - offset);
+        crcImage(offset, bytes, chunk);
+        image.bankSums[bank] += byteSum(bytes, chunk);
+        offset += chunk;
+        bytes += chunk;
+        length -= chunk;
+    }
+}
+
+void sfcImageBuilder::append(const uint8_t* bytes, size_t length) {
+    while (length && !complete()) {
+        size_t chunk = length;
+        if (!retain && received >= headerSize) {
+            // Image data that isn't kept is summed where it is rather than copied through the scratch buffer
+            chunk = min(length, fileSize - received);
+            take(bytes, chunk);
+        } else {
+            uint8_t* destination = buffer(chunk);
+            copy(bytes, bytes + chunk, destination);
+            commit(chunk);
+        }
+        bytes += chunk;
+        length -= chunk;
+    }
+}
+
+void sfcImageBuilder::skipZeros(size_t length) {
+    length = min(length, fileSize - received);
+    while (length) {
+        size_t chunk = length;
+        if (received < headerSize) {
+            chunk = min(length, headerSize - received);
+            crc = crc32Zeros(chunk, crc);
+        } else {
+            size_t offset = received - headerSize;
+            chunk = min(length, (offset / sfcBankSize + 1) * sfcBankSize - offset);
+            crcImage(offset, nullptr, chunk);
+        }
+        received += chunk;
+        length -= chunk;
+    }
+}
+
+// Continue the file's CRC32 over image bytes within one bank (zeros without `bytes`)
+// Without retaining, a bank's own CRC32 is worked out from the file's at its start and end once it's complete:
+// crc(bank) = crc(before + bank) ^ crc(before + zeros) ^ crc(zeros), as CRC32 is linear
+void sfcImageBuilder::crcImage(size_t offset, const uint8_t* bytes, size_t length) {
+    if (!retain && offset % sfcBankSize == 0) { bankStartCrc = crc; }
+    crc = bytes ? crc32(bytes, length, crc) : length == sfcBankSize ? bankZeros(crc) : crc32Zeros(length, crc);
+    size_t end = offset + length;
+    if (!retain && (end % sfcBankSize == 0 || end == image.length)) {
+        size_t bankLength = end - offset / sfcBankSize * sfcBankSize;
+        image.bankCrcs[offset / sfcBankSize] = bankLength == sfcBankSize ? crc ^ bankZeros(bankStartCrc) ^ bankZeros()
+                                                                         : crc ^ crc32Zeros(bankLength, bankStartCrc) ^ crc32Zeros(bankLength);
+    }
+}
+
+sfcImage sfcImageBuilder::finish() {
+    if (fileSize == sfcUnknownSize) {
+        fileSize = received;
+        if (received == maxStreamSize) { return sfcImage(); }
+        if ((received & 0x3ff) == 0x200) {
+            image.copierHeader.assign(image.data.begin(), image.data.begin() + 0x200);
+            image.data.erase(image.data.begin(), image.data.begin() + 0x200);
+            image.length = image.data.size();
+            image.sumBanks();
+        }
+    }
+    if (!complete()) { return sfcImage(); }
+    return std::move(image);
+}
+
+uint32_t byteSum(const uint8_t* bytes, size_t length) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < length; ++i) {
+        sum += bytes[i];
+    }
+    return sum;
+}
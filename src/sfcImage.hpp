@@ -0,0 +1,138 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <vector>
+
+inline constexpr size_t sfcBankSize = 0x8000;
+
+// Image areas read by header detection (offset, length): reset vector targets and the header candidates
+inline constexpr std::array<std::pair<size_t, size_t>, 2> sfcHeaderWindows = {{{0x000000, 0x10000}, {0x400000, 0x10000}}};
+
+// Image size accepted for checking (excluding copier header)
+inline bool validImageSize(size_t size) { return size >= 0x8000 && size <= 0xc00000 && size % 0x8000 == 0; }
+
+// Allocates zeroed memory with calloc and leaves elements uninitialized, so the pages of a large image are only
+// backed once something is written to them (holes in sparse files never are)
+template <typename T>
+struct sfcZeroedAllocator {
+    using value_type = T;
+
+    sfcZeroedAllocator() = default;
+    template <typename U>
+    sfcZeroedAllocator(const sfcZeroedAllocator<U>&) {}
+
+    T* allocate(size_t count) {
+        if (void* memory = std::calloc(count, sizeof(T))) { return static_cast<T*>(memory); }
+        throw std::bad_alloc();
+    }
+    void deallocate(T* memory, size_t) { std::free(memory); }
+
+    template <typename U>
+    void construct(U*) {}
+    template <typename U, typename... Args>
+    void construct(U* at, Args&&... args) {
+        ::new (static_cast<void*>(at)) U(std::forward<Args>(args)...);
+    }
+
+    template <typename U>
+    bool operator==(const sfcZeroedAllocator<U>&) const {
+        return true;
+    }
+    template <typename U>
+    bool operator!=(const sfcZeroedAllocator<U>&) const {
+        return false;
+    }
+};
+
+// Image bytes, zero until written (growing after a shrink must clear the regrown part explicitly)
+using sfcBytes = std::vector<uint8_t, sfcZeroedAllocator<uint8_t>>;
+
+// Bytes kept from a streamed image that wasn't retained in full
+struct sfcWindow {
+    size_t offset = 0;
+    std::vector<uint8_t> bytes;
+};
+
+// ROM image (without copier header) along with the byte sum of each 32KB bank
+// Modify through put/assign/resize so bank sums stay current
+struct sfcImage {
+    std::vector<uint8_t> copierHeader;
+    sfcBytes data;
+    std::vector<uint32_t> bankSums;
+
+    // When not retained in full, only the areas needed for header detection are kept, along with the CRC32 of each
+    // bank (as read, left empty once the image is modified) to tell identical banks without their bytes
+    std::vector<sfcWindow> windows;
+    std::vector<uint32_t> bankCrcs;
+    size_t length = 0;
+
+    size_t size() const { return length; }
+    bool retained() const { return data.size() == length; }
+
+    uint8_t operator[](size_t offset) const;
+
+    void sumBanks();
+    void put(size_t offset, uint8_t value);
+    void assign(size_t offset, const uint8_t* bytes, size_t length);
+    void resize(size_t size);
+
+    // Reorder an interleaved HiROM image in place (size must be a multiple of 64KB)
+    void deinterleave();
+
+    // Byte sum of range, using bank sums for whole banks (ranges in a non-retained image must be bank aligned)
+    uint64_t sum(size_t offset, size_t length) const;
+
+  private:
+    uint8_t* locate(size_t offset);
+    const uint8_t* locate(size_t offset) const;
+};
+
+// Offset in an interleaved HiROM image of `offset` in the de-interleaved image:
+// the upper 32KB halves of all 64KB banks come first, followed by the lower halves
+inline size_t interleavedOffset(size_t offset, size_t size) {
+    size_t block = offset / sfcBankSize;
+    size_t source = (block & 1) ? block >> 1 : (size / sfcBankSize >> 1) + (block >> 1);
+    return source * sfcBankSize + offset % sfcBankSize;
+}
+
+inline constexpr size_t sfcUnknownSize = SIZE_MAX;
+
+// Accumulates an image arriving in file order: crc32 of the file, copier header, bank sums
+// and either the complete image or just the header windows
+// With sfcUnknownSize (pipes) the image is always retained, and read until the source ends
+struct sfcImageBuilder {
+    explicit sfcImageBuilder(size_t fileSize, bool retain = true);
+
+    // Space for up to `length` more bytes, to be followed by commit() with the amount actually filled
+    uint8_t* buffer(size_t& length);
+    void commit(size_t length);
+    void append(const uint8_t* bytes, size_t length);
+
+    // Account for `length` zero bytes (a hole in a sparse file) without storing anything, the image starts out zeroed
+    void skipZeros(size_t length);
+
+    bool complete() const { return received == fileSize; }
+    sfcImage finish();
+
+    size_t fileSize = 0;
+    size_t received = 0;
+    uint32_t crc = 0;
+
+  private:
+    sfcImage image;
+    size_t headerSize = 0;
+    bool retain = true;
+    uint8_t* pending = nullptr;
+    std::vector<uint8_t> scratch;
+    uint32_t bankStartCrc = 0;
+
+    void take(const uint8_t* bytes, size_t length);
+    void crcImage(size_t offset, const uint8_t* bytes, size_t length);
+};
+
+uint32_t byteSum(const uint8_t* bytes, size_t length);
@@ -0,0 +1,301 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "sfcCrc.hpp"
+#include "sfcPatch.hpp"
+
+using namespace std;
+
+constexpr size_t ipsEofMarker = 0x454f46;
+constexpr size_t ipsMaxRecordSize = 0xffff;
+
+enum bpsAction : uint8_t { sourceRead = 0, targetRead = 1, sourceCopy = 2, targetCopy = 3 };
+
+void putNumber(vector<uint8_t>& out, uint64_t value);
+void putLong(vector<uint8_t>& out, uint32_t value);
+bool getNumber(const vector<uint8_t>& in, size_t& pos, size_t end, uint64_t& value);
+uint32_t getLong(const vector<uint8_t>& in, size_t pos);
+string applyIpsPatch(const vector<uint8_t>& patch, sfcImage& image);
+string applyBpsPatch(const vector<uint8_t>& patch, sfcImage& image);
+
+sfcPatchFormat patchFormat(const string& path) {
+    string ext = filesystem::path(path).extension().string();
+    transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)tolower(c); });
+    if (ext == ".ips") { return sfcPatchFormat::ips; }
+    if (ext == ".bps") { return sfcPatchFormat::bps; }
+    return sfcPatchFormat::none;
+}
+
+vector<sfcPatchRecord> diffRecords(const uint8_t* source, const uint8_t* target, size_t length, size_t offset) {
+    vector<sfcPatchRecord> records;
+    size_t i = 0;
+    while (i < length) {
+        if (source[i] == target[i]) {
+            ++i;
+            continue;
+        }
+        size_t start = i;
+        while (i < length && source[i] != target[i]) {
+            ++i;
+        }
+        // An IPS record can't start at the offset spelling "EOF", so include the preceding byte
+        if (offset + start == ipsEofMarker && start > 0) { --start; }
+        records.push_back({offset + start, vector<uint8_t>(target + start, target + i)});
+    }
+    return records;
+}
+
+vector<uint8_t> makeIpsPatch(const vector<sfcPatchRecord>& records, size_t truncateSize) {
+    vector<uint8_t> out = {'P', 'A', 'T', 'C', 'H'};
+    for (const auto& record : records) {
+        for (size_t done = 0; done < record.data.size(); done += ipsMaxRecordSize) {
+            size_t offset = record.offset + done;
+            size_t length = min(record.data.size() - done, ipsMaxRecordSize);
+            out.push_back((uint8_t)(offset >> 16));
+            out.push_back((uint8_t)(offset >> 8));
+            out.push_back((uint8_t)offset);
+            out.push_back((uint8_t)(length >> 8));
+            out.push_back((uint8_t)length);
+            out.insert(out.end(), record.data.begin() + done, record.data.begin() + done + length);
+        }
+    }
+    out.insert(out.end(), {'E', 'O', 'F'});
+    if (truncateSize) {
+        out.push_back((uint8_t)(truncateSize >> 16));
+        out.push_back((uint8_t)(truncateSize >> 8));
+        out.push_back((uint8_t)truncateSize);
+    }
+    return out;
+}
+
+vector<uint8_t> makeBpsPatch(
+    const vector<sfcPatchRecord>& records, size_t sourceSize, size_t sourceOffset, uint32_t sourceCrc, size_t targetSize,
+    uint32_t targetCrc
+) {
+    vector<uint8_t> out = {'B', 'P', 'S', '1'};
+    putNumber(out, sourceSize);
+    putNumber(out, targetSize);
+    putNumber(out, 0); // No metadata
+
+    size_t outputOffset = 0;
+    size_t sourceRelativeOffset = 0;
+
+    // Unchanged bytes come straight from the source, shifted by sourceOffset
+    auto copyUnchanged = [&](size_t end) {
+        if (end <= outputOffset) { return; }
+        size_t length = end - outputOffset;
+        if (sourceOffset == 0) {
+            putNumber(out, ((length - 1) << 2) | sourceRead);
+        } else {
+            putNumber(out, ((length - 1) << 2) | sourceCopy);
+            int64_t relative = (int64_t)(outputOffset + sourceOffset) - (int64_t)sourceRelativeOffset;
+            putNumber(out, ((uint64_t)(relative < 0 ? -relative : relative) << 1) | (relative < 0 ? 1 : 0));
+            sourceRelativeOffset = outputOffset + sourceOffset + length;
+        }
+        outputOffset = end;
+    };
+
+    for (const auto& record : records) {
+        if (record.data.empty()) { continue; }
+        copyUnchanged(record.offset);
+        putNumber(out, ((record.data.size() - 1) << 2) | targetRead);
+        out.insert(out.end(), record.data.begin(), record.data.end());
+        outputOffset += record.data.size();
+    }
+    copyUnchanged(targetSize);
+
+    putLong(out, sourceCrc);
+    putLong(out, targetCrc);
+    putLong(out, crc32(out.data(), out.size()));
+    return out;
+}
+
+string applyPatch(const vector<uint8_t>& patch, sfcImage& image) {
+    if (patch.size() >= 8 && equal(patch.begin(), patch.begin() + 5, "PATCH")) { return applyIpsPatch(patch, image); }
+    if (patch.size() >= 16 && equal(patch.begin(), patch.begin() + 4, "BPS1")) { return applyBpsPatch(patch, image); }
+    return "unknown patch format";
+}
+
+string applyIpsPatch(const vector<uint8_t>& patch, sfcImage& image) {
+    size_t pos = 5;
+    while (true) {
+        if (pos + 3 > patch.size()) { return "IPS patch is truncated"; }
+        size_t offset = (patch[pos] << 16) | (patch[pos + 1] << 8) | patch[pos + 2];
+        pos += 3;
+        if (offset == ipsEofMarker) { break; }
+
+        if (pos + 2 > patch.size()) { return "IPS patch is truncated"; }
+        size_t length = (patch[pos] << 8) | patch[pos + 1];
+        pos += 2;
+
+        const uint8_t* bytes = nullptr;
+        vector<uint8_t> run;
+        if (length == 0) {
+            // RLE record
+            if (pos + 3 > patch.size()) { return "IPS patch is truncated"; }
+            length = (patch[pos] << 8) | patch[pos + 1];
+            run.assign(length, patch[pos + 2]);
+            bytes = run.data();
+            pos += 3;
+        } else {
+            if (pos + length > patch.size()) { return "IPS patch is truncated"; }
+            bytes = &patch[pos];
+            pos += length;
+        }
+
+        if (offset + length > image.size()) { image.resize(offset + length); }
+        image.assign(offset, bytes, length);
+    }
+
+    // Optional truncation extension
+    if (pos + 3 == patch.size()) { image.resize((patch[pos] << 16) | (patch[pos + 1] << 8) | patch[pos + 2]); }
+    return string();
+}
+
+string applyBpsPatch(const vector<uint8_t>& patch, sfcImage& image) {
+    size_t end = patch.size() - 12;
+    if (crc32(patch.data(), patch.size() - 4) != getLong(patch, end + 8)) { return "BPS patch is corrupt"; }
+
+    size_t pos = 4;
+    uint64_t sourceSize = 0, targetSize = 0, metadataSize = 0;
+    if (!getNumber(patch, pos, end, sourceSize) || !getNumber(patch, pos, end, targetSize) ||
+        !getNumber(patch, pos, end, metadataSize) || metadataSize > end - pos) {
+        return "BPS patch is corrupt";
+    }
+    pos += metadataSize;
+
+    // Patches are made either for the image or for the file as is, copier header included
+    sfcBytes wholeFile;
+    if (!image.copierHeader.empty() && sourceSize == image.copierHeader.size() + image.data.size()) {
+        wholeFile.resize(sourceSize);
+        copy(image.copierHeader.begin(), image.copierHeader.end(), wholeFile.begin());
+        copy(image.data.begin(), image.data.end(), wholeFile.begin() + image.copierHeader.size());
+    }
+    const sfcBytes& source = wholeFile.empty() ? image.data : wholeFile;
+    if (sourceSize != source.size() || crc32(source.data(), source.size()) != getLong(patch, end)) {
+        return "BPS patch was made for a different source image";
+    }
+    if (targetSize > 0x1000000) { return "BPS patch target is too large"; }
+
+    sfcBytes target(targetSize);
+    vector<pair<size_t, size_t>> patchedRanges;
+    size_t outputOffset = 0, sourceRelativeOffset = 0, targetRelativeOffset = 0;
+
+    while (pos < end) {
+        uint64_t data = 0;
+        if (!getNumber(patch, pos, end, data)) { return "BPS patch is corrupt"; }
+        size_t length = (data >> 2) + 1;
+        if (length > targetSize - outputOffset) { return "BPS patch is corrupt"; }
+
+        uint8_t action = data & 3;
+        if (action == sourceRead) {
+            if (outputOffset + length > source.size()) { return "BPS patch is corrupt"; }
+            copy_n(&source[outputOffset], length, &target[outputOffset]);
+        } else if (action == targetRead) {
+            if (length > end - pos) { return "BPS patch is corrupt"; }
+            copy_n(&patch[pos], length, &target[outputOffset]);
+            pos += length;
+        } else {
+            uint64_t relative = 0;
+            if (!getNumber(patch, pos, end, relative)) { return "BPS patch is corrupt"; }
+            // Offsets only move within what they copy from, so they can't wrap around
+            uint64_t distance = relative >> 1;
+            bool backwards = relative & 1;
+            if (action == sourceCopy) {
+                if (backwards ? distance > sourceRelativeOffset : distance > source.size() - sourceRelativeOffset) {
+                    return "BPS patch is corrupt";
+                }
+                sourceRelativeOffset = backwards ? sourceRelativeOffset - distance : sourceRelativeOffset + distance;
+                if (length > source.size() - sourceRelativeOffset) { return "BPS patch is corrupt"; }
+                copy_n(&source[sourceRelativeOffset], length, &target[outputOffset]);
+                sourceRelativeOffset += length;
+            } else {
+                if (backwards ? distance > targetRelativeOffset : distance >= outputOffset - targetRelativeOffset) {
+                    return "BPS patch is corrupt";
+                }
+                targetRelativeOffset = backwards ? targetRelativeOffset - distance : targetRelativeOffset + distance;
+                // Byte by byte, since source and destination may overlap
+                for (size_t i = 0; i < length; ++i) {
+                    target[outputOffset + i] = target[targetRelativeOffset++];
+                }
+            }
+        }
+
+        if (action != sourceRead) {
+            if (!patchedRanges.empty() && patchedRanges.back().first + patchedRanges.back().second == outputOffset) {
+                patchedRanges.back().second += length;
+            } else {
+                patchedRanges.emplace_back(outputOffset, length);
+            }
+        }
+        outputOffset += length;
+    }
+
+    if (outputOffset != targetSize || crc32(target.data(), target.size()) != getLong(patch, end + 4)) {
+        return "BPS patch produced a bad target image";
+    }
+
+    if (!wholeFile.empty()) {
+        // The target is a file too, with or without copier header
+        size_t headerSize = (targetSize & 0x3ff) == 0x200 ? 0x200 : 0;
+        image.copierHeader.assign(target.begin(), target.begin() + headerSize);
+        target.erase(target.begin(), target.begin() + headerSize);
+        image.data = std::move(target);
+        image.length = image.data.size();
+        image.sumBanks();
+    } else if (targetSize == source.size()) {
+        // Same layout, so only the bank sums of patched ranges change
+        for (auto [offset, length] : patchedRanges) {
+            image.assign(offset, &target[offset], length);
+        }
+    } else {
+        image.data = std::move(target);
+        image.length = image.data.size();
+        image.sumBanks();
+    }
+    return string();
+}
+
+// BPS variable length number
+bool getNumber(const vector<uint8_t>& in, size_t& pos, size_t end, uint64_t& value) {
+    value = 0;
+    uint64_t shift = 1;
+    while (pos < end && shift < (1ull << 56)) {
+        uint8_t x = in[pos++];
+        value += (x & 0x7f) * shift;
+        if (x & 0x80) { return true; }
+        shift <<= 7;
+        value += shift;
+    }
+    return false;
+}
+
+// Little endian long
+uint32_t getLong(const vector<uint8_t>& in, size_t pos) {
+    return in[pos] | (in[pos + 1] << 8) | (in[pos + 2] << 16) | ((uint32_t)in[pos + 3] << 24);
+}
+
+// BPS variable length number
+void putNumber(vector<uint8_t>& out, uint64_t value) {
+    while (true) {
+        uint8_t x = value & 0x7f;
+        value >>= 7;
+        if (value == 0) {
+            out.push_back(0x80 | x);
+            break;
+        }
+        out.push_back(x);
+        --value;
+    }
+}
+
+// Little endian long
+void putLong(vector<uint8_t>& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back((uint8_t)(value >> (i * 8)));
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "sfcImage.hpp"
+
+enum class sfcPatchFormat { none, ips, bps };
+
+// Run of changed bytes in the target image
+struct sfcPatchRecord {
+    size_t offset = 0;
+    std::vector<uint8_t> data;
+};
+
+// Patch format implied by file extension (".ips" or ".bps")
+sfcPatchFormat patchFormat(const std::string& path);
+
+// Collect runs of bytes that differ between two equally sized windows located at `offset`
+std::vector<sfcPatchRecord> diffRecords(const uint8_t* source, const uint8_t* target, size_t length, size_t offset);
+
+// IPS patch applying records to a source of the same size as the target
+// A nonzero `truncateSize` is appended after "EOF" (the common truncation extension) to cut the target to that size
+std::vector<uint8_t> makeIpsPatch(const std::vector<sfcPatchRecord>& records, size_t truncateSize = 0);
+
+// BPS patch producing a target of `targetSize` bytes from a source of `sourceSize` bytes
+// Unchanged target bytes are copied from source offset + `sourceOffset` (eg. 0x200 to drop a copier header)
+std::vector<uint8_t> makeBpsPatch(
+    const std::vector<sfcPatchRecord>& records, size_t sourceSize, size_t sourceOffset, uint32_t sourceCrc, size_t targetSize,
+    uint32_t targetCrc
+);
+
+// Apply IPS or BPS patch to a fully retained image in place, updating bank sums only for the patched ranges
+// IPS patches apply to the image without copier header, BPS patches to either that or the whole file
+// Returns a description of the problem if the patch is malformed or doesn't match the image
+std::string applyPatch(const std::vector<uint8_t>& patch, sfcImage& image);
@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "sfcFile.hpp"
+#include "sfcImage.hpp"
+#include "sfcReader.hpp"
+
+using namespace std;
+
+// Large reads, so a batch of files on a spinning disk is read close to sequential bandwidth
+constexpr size_t readChunkSize = 0x400000;
+
+// Longest numbered part extension, eg. ".001"
+constexpr size_t maxPartDigits = 4;
+
+sfcImage readOpenParts(vector<sfcFile>& files, const vector<string>& paths, bool retain, string& error, bool keepCache);
+bool readExtents(sfcFile& file, size_t offset, sfcImageBuilder& builder);
+
+sfcImage readFile(const string& path, bool retain, string& error, bool keepCache) {
+    sfcFile file(path);
+    if (!file.isOpen()) {
+        error = "Cannot open file \"" + path + "\"";
+        return sfcImage();
+    }
+    return readOpenFile(file, path, retain, error, keepCache);
+}
+
+sfcImage readOpenFile(sfcFile& file, const string& path, bool retain, string& error, bool keepCache) {
+    if (file.size()) {
+        vector<sfcFile> files;
+        files.push_back(std::move(file));
+        sfcImage image = readOpenParts(files, {path}, retain, error, keepCache);
+        file = std::move(files[0]);
+        return image;
+    }
+
+    // Pipes are read until they end
+    sfcImageBuilder builder(sfcUnknownSize, retain);
+    while (true) {
+        size_t chunk = readChunkSize;
+        uint8_t* destination = builder.buffer(chunk);
+        size_t length = file.read(destination, chunk);
+        builder.commit(length);
+        if (length < chunk || chunk == 0) { break; }
+    }
+    return builder.finish();
+}
+
+sfcImage readBytes(sfcBytes&& bytes, bool retain) {
+    if (!retain) { return readMemory(bytes); }
+    size_t headerSize = (bytes.size() & 0x3ff) == 0x200 ? 0x200 : 0;
+    if (!validImageSize(bytes.size() - headerSize)) { return sfcImage(); }
+
+    sfcImage image;
+    image.copierHeader.assign(bytes.begin(), bytes.begin() + headerSize);
+    bytes.erase(bytes.begin(), bytes.begin() + headerSize);
+    image.data = std::move(bytes);
+    image.length = image.data.size();
+    image.sumBanks();
+    return image;
+}
+
+sfcImage readMemory(span<const uint8_t> bytes) {
+    size_t headerSize = (bytes.size() & 0x3ff) == 0x200 ? 0x200 : 0;
+    if (!validImageSize(bytes.size() - headerSize)) { return sfcImage(); }
+    sfcImageBuilder builder(bytes.size(), false);
+    builder.append(bytes.data(), bytes.size());
+    return builder.finish();
+}
+
+sfcImage readParts(const vector<string>& paths, bool retain, string& error, bool keepCache) {
+    vector<sfcFile> files;
+    for (const auto& path : paths) {
+        files.emplace_back(path);
+        if (!files.back().isOpen()) {
+            error = "Cannot open file \"" + path + "\"";
+            return sfcImage();
+        }
+    }
+    return readOpenParts(files, paths, retain, error, keepCache);
+}
+
+sfcImage readOpenParts(vector<sfcFile>& files, const vector<string>& paths, bool retain, string& error, bool keepCache) {
+    vector<size_t> skips;
+    size_t totalSize = 0;
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        // Copier headers on later parts are skipped, the one on the first part is kept as the image's
+        size_t size = files[i].size();
+        size_t skip = (i > 0 && (size & 0x3ff) == 0x200) ? 0x200 : 0;
+        totalSize += size - skip;
+        skips.push_back(skip);
+    }
+
+    size_t headerSize = (totalSize & 0x3ff) == 0x200 ? 0x200 : 0;
+    if (!validImageSize(totalSize - headerSize)) { return sfcImage(); }
+
+    sfcImageBuilder builder(totalSize, retain);
+    for (size_t i = 0; i < files.size(); ++i) {
+        vector<uint8_t> cached = keepCache ? vector<uint8_t>() : residentPages(files[i].fd, files[i].size());
+        if (!readExtents(files[i], skips[i], builder)) {
+            error = "Cannot read file \"" + paths[i] + "\"";
+            return sfcImage();
+        }
+        // Once summed the file isn't needed again, so a scan doesn't push everything else out of the page cache,
+        // but what was cached before is left there
+        if (!keepCache) { dropPages(files[i].fd, cached); }
+    }
+    return builder.finish();
+}
+
+// Read a regular file from offset to its end, only reading data extents: holes are zeros that add nothing
+// to bank sums, so they are passed over without I/O or touching the image
+bool readExtents(sfcFile& file, size_t offset, sfcImageBuilder& builder) {
+    size_t size = file.size();
+    file.advise(sfcFileAdvice::sequential);
+    while (offset < size) {
+        auto [begin, end] = file.dataExtent(offset);
+        builder.skipZeros(begin - offset);
+        for (offset = begin; offset < end;) {
+            size_t chunk = min(end - offset, readChunkSize);
+            uint8_t* destination = builder.buffer(chunk);
+            // Read the next chunk ahead while this one is summed
+            if (offset + chunk < end) { file.advise(sfcFileAdvice::willNeed, offset + chunk, min(end - offset - chunk, readChunkSize)); }
+            if (chunk == 0 || file.readAt(offset, destination, chunk) != chunk) { return false; }
+            builder.commit(chunk);
+            offset += chunk;
+        }
+    }
+    return true;
+}
+
+vector<string> findParts(const string& path) {
+    vector<string> parts = {path};
+    filesystem::path first(path);
+    string stem = first.stem().string();
+    string ext = first.extension().string();
+
+    auto sibling = [&](const string& name) { return (first.parent_path() / name).string(); };
+
+    string digits = ext.empty() ? string() : ext.substr(1);
+    unsigned number = 0;
+    if (!digits.empty() && digits.size() <= maxPartDigits && digits.find_first_not_of("0123456789") == string::npos &&
+        from_chars(digits.data(), digits.data() + digits.size(), number).ec == errc()) {
+        // name.1, name.2, ... or zero padded to the width of the first, name.01, name.02, ...
+        auto numbered = [&](unsigned n) {
+            string next = to_string(n);
+            return sibling(stem + "." + string(digits.size() > next.size() ? digits.size() - next.size() : 0, '0') + next);
+        };
+        for (unsigned n = number + 1; filesystem::is_regular_file(numbered(n)); ++n) {
+            parts.push_back(numbered(n));
+        }
+    }
+    if (parts.size() == 1 && !stem.empty() && isalpha((unsigned char)stem.back())) {
+        // nameA.078, nameB.078, ...
+        for (char c = (char)(stem.back() + 1); isalpha((unsigned char)c); ++c) {
+            string name = stem.substr(0, stem.size() - 1) + c + ext;
+            if (!filesystem::is_regular_file(sibling(name))) { break; }
+            parts.push_back(sibling(name));
+        }
+    }
+    return parts;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "sfcFile.hpp"
+#include "sfcImage.hpp"
+
+// Read a plain image file (or stdin as "-") straight into an image
+// Files are read with readahead, and the pages reading brings in are dropped from the page cache afterwards unless
+// `keepCache` is set
+sfcImage readFile(const std::string& path, bool retain, std::string& error, bool keepCache = true);
+
+// Read an image from a file that is already open (eg. one passed by another process), named `path` in errors
+sfcImage readOpenFile(sfcFile& file, const std::string& path, bool retain, std::string& error, bool keepCache = true);
+
+// Image from a file's complete content, taking over the bytes when the image is retained
+sfcImage readBytes(sfcBytes&& bytes, bool retain);
+
+// Image summed straight from a file's complete content in memory, keeping only the header windows (no copy)
+sfcImage readMemory(std::span<const uint8_t> bytes);
+
+// Read split copier files as one logical image
+// Each part is read directly into its slice of the image, and only the first part may carry a copier header
+sfcImage readParts(const std::vector<std::string>& paths, bool retain, std::string& error, bool keepCache = true);
+
+// Ordered parts of a split set starting with `path`, following "name.1, name.2, ..." (or zero padded "name.01, ...")
+// or "nameA.078, nameB.078, ..." naming; just `path` if no further parts exist
+std::vector<std::string> findParts(const std::string& path);
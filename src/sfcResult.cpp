@@ -0,0 +1,399 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "sfcFile.hpp"
+#include "sfcResult.hpp"
+#include "sfcRom.hpp"
+
+using namespace std;
+
+// Binary result files start with this, followed by records of a 32 bit length and the fields
+const string binaryMagic = string("SFCR\1", 5);
+
+// Checkpoints are written out at most this often
+const chrono::milliseconds checkpointInterval(1000);
+
+void putNumber(string& out, uint64_t value, int bytes);
+void putString(string& out, const string& value);
+string jsonString(const string& value);
+string decodeBinary(const string& content, vector<sfcResult>& results);
+string decodeJson(const string& content, vector<sfcResult>& results);
+
+sfcResult makeResult(const string& name, const sfcRom& rom, const string& report) {
+    sfcResult result;
+    result.name = name;
+    result.isValid = rom.isValid;
+    result.hasIssues = rom.hasIssues;
+    result.hasSevereIssues = rom.hasSevereIssues;
+    result.title = rom.title;
+    result.mapper = rom.mapperName;
+    result.imageSize = rom.imageSize;
+    result.realSize = rom.realSize;
+    result.checksum = rom.checksum;
+    result.correctedChecksum = rom.correctedChecksum;
+    result.report = report;
+    return result;
+}
+
+sfcRingRecord makeRingRecord(const string& name, const sfcRom& rom) {
+    sfcRingRecord record;
+    record.imageSize = rom.imageSize;
+    record.realSize = rom.realSize;
+    record.headerLocation = rom.headerLocation;
+    record.imageOffset = rom.imageOffset;
+    pair<bool, uint32_t> flags[] = {
+        {rom.isValid, sfcRingValid},
+        {rom.hasIssues, sfcRingIssues},
+        {rom.hasSevereIssues, sfcRingSevereIssues},
+        {rom.hasCopierHeader, sfcRingCopierHeader},
+        {rom.hasCorrectTitle, sfcRingCorrectTitle},
+        {rom.hasCorrectRamSize, sfcRingCorrectRamSize},
+        {rom.hasCorrectChecksum, sfcRingCorrectChecksum},
+        {rom.hasLegalMode, sfcRingLegalMode},
+        {rom.hasKnownMapper, sfcRingKnownMapper},
+        {rom.hasNewFormatHeader, sfcRingNewFormatHeader},
+        {rom.isPatched, sfcRingPatched},
+        {rom.isInterleaved, sfcRingInterleaved},
+        {rom.fast, sfcRingFast},
+        {rom.hasRam, sfcRingHasRam},
+    };
+    for (auto [set, flag] : flags) {
+        if (set) { record.flags |= flag; }
+    }
+    record.checksum = rom.checksum;
+    record.complement = rom.complement;
+    record.correctedChecksum = rom.correctedChecksum;
+    record.correctedComplement = rom.correctedComplement;
+    record.mode = rom.mode;
+    record.mapper = rom.mapper;
+    record.chipset = rom.chipset;
+    record.chipsetSubtype = rom.chipsetSubtype;
+    record.romSize = rom.romSize;
+    record.ramSize = rom.ramSize;
+    record.countryCode = rom.countryCode;
+    record.correctedMode = rom.correctedMode;
+    record.correctedRomSize = rom.correctedRomSize;
+
+    // Long paths keep their end, which tells images apart
+    size_t length = min(name.size(), sizeof(record.name) - 1);
+    memcpy(record.name, name.data() + name.size() - length, length);
+    return record;
+}
+
+sfcResultFormat resultFormat(const string& path) {
+    string extension = path.substr(min(path.size(), path.rfind('.')));
+    transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)tolower(c); });
+    if (extension == ".ndjson" || extension == ".jsonl" || extension == ".json") { return sfcResultFormat::ndjson; }
+    return sfcResultFormat::binary;
+}
+
+string resultsHeader(sfcResultFormat format) {
+    return format == sfcResultFormat::binary ? binaryMagic : string();
+}
+
+string encodeResult(const sfcResult& result, sfcResultFormat format) {
+    string out;
+    if (format == sfcResultFormat::ndjson) {
+        out += "{\"name\":" + jsonString(result.name);
+        out += string(",\"valid\":") + (result.isValid ? "true" : "false");
+        out += string(",\"issues\":") + (result.hasIssues ? "true" : "false");
+        out += string(",\"severe\":") + (result.hasSevereIssues ? "true" : "false");
+        out += ",\"title\":" + jsonString(result.title);
+        out += ",\"mapper\":" + jsonString(result.mapper);
+        out += ",\"imageSize\":" + to_string(result.imageSize);
+        out += ",\"realSize\":" + to_string(result.realSize);
+        out += ",\"checksum\":" + to_string(result.checksum);
+        out += ",\"correctedChecksum\":" + to_string(result.correctedChecksum);
+        out += ",\"report\":" + jsonString(result.report) + "}\n";
+        return out;
+    }
+
+    string fields;
+    putString(fields, result.name);
+    putNumber(fields, (result.isValid ? 1 : 0) | (result.hasIssues ? 2 : 0) | (result.hasSevereIssues ? 4 : 0), 1);
+    putString(fields, result.title);
+    putString(fields, result.mapper);
+    putNumber(fields, result.imageSize, 8);
+    putNumber(fields, result.realSize, 8);
+    putNumber(fields, result.checksum, 2);
+    putNumber(fields, result.correctedChecksum, 2);
+    putString(fields, result.report);
+    putNumber(out, fields.size(), 4);
+    return out + fields;
+}
+
+string readResults(const string& path, vector<sfcResult>& results) {
+    sfcFile file(path);
+    if (!file.isOpen()) { return "Cannot open file \"" + path + "\""; }
+    string content;
+    char buffer[0x10000];
+    for (size_t length; (length = file.read((uint8_t*)buffer, sizeof(buffer))) > 0;) {
+        content.append(buffer, length);
+    }
+    string error = decodeResults(content, results);
+    return error.empty() ? error : "\"" + path + "\": " + error;
+}
+
+string decodeResults(const string& content, vector<sfcResult>& results) {
+    if (content.compare(0, binaryMagic.size(), binaryMagic) == 0) { return decodeBinary(content, results); }
+    return decodeJson(content, results);
+}
+
+string sfcCheckpoint::open(const string& path, bool resume) {
+    vector<sfcResult> kept;
+    if (resume && filesystem::exists(path)) {
+        // Whatever was cut short by the interruption is done again
+        readResults(path, kept);
+        for (const auto& result : kept) {
+            resumed[result.name] = result;
+        }
+    }
+
+    // Start over from the records kept, replacing the old file only once they're written
+    string temporaryPath = path + ".tmp";
+    string content = resultsHeader(sfcResultFormat::binary);
+    for (const auto& result : kept) {
+        content += encodeResult(result, sfcResultFormat::binary);
+    }
+    file = sfcFile(temporaryPath, sfcFileMode::create);
+    error_code ec;
+    if (!file.isOpen() || !file.write((const uint8_t*)content.data(), content.size()) || !file.sync() ||
+        (filesystem::rename(temporaryPath, path, ec), ec)) {
+        file = sfcFile();
+        return "Cannot open file \"" + path + "\" for writing";
+    }
+    lastWrite = chrono::steady_clock::now();
+    return string();
+}
+
+const sfcResult* sfcCheckpoint::find(const string& path) const {
+    auto found = resumed.find(path);
+    return found == resumed.end() ? nullptr : &found->second;
+}
+
+void sfcCheckpoint::add(const sfcResult& result) {
+    if (!file.isOpen()) { return; }
+    lock_guard<mutex> guard(lock);
+    pending += encodeResult(result, sfcResultFormat::binary);
+    if (chrono::steady_clock::now() - lastWrite < checkpointInterval) { return; }
+    file.write((const uint8_t*)pending.data(), pending.size());
+    file.sync();
+    pending.clear();
+    lastWrite = chrono::steady_clock::now();
+}
+
+void sfcCheckpoint::flush() {
+    lock_guard<mutex> guard(lock);
+    if (!file.isOpen() || pending.empty()) { return; }
+    file.write((const uint8_t*)pending.data(), pending.size());
+    file.sync();
+    pending.clear();
+    lastWrite = chrono::steady_clock::now();
+}
+
+void putNumber(string& out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        out += (char)(value >> (i * 8) & 0xff);
+    }
+}
+
+void putString(string& out, const string& value) {
+    putNumber(out, value.size(), 4);
+    out += value;
+}
+
+string jsonString(const string& value) {
+    string out = "\"";
+    for (unsigned char c : value) {
+        switch (c) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if (c < 0x20) {
+                char escape[8];
+                snprintf(escape, sizeof(escape), "\\u%04x", c);
+                out += escape;
+            } else {
+                out += (char)c;
+            }
+            break;
+        }
+    }
+    return out + "\"";
+}
+
+string decodeBinary(const string& content, vector<sfcResult>& results) {
+    size_t at = binaryMagic.size();
+    auto number = [&](int bytes, size_t end) {
+        uint64_t value = 0;
+        for (int i = 0; i < bytes && at < end; ++i) {
+            value |= (uint64_t)(uint8_t)content[at++] << (i * 8);
+        }
+        return value;
+    };
+
+    while (at < content.size()) {
+        if (content.size() - at < 4) { return "Truncated record"; }
+        size_t length = number(4, content.size());
+        if (content.size() - at < length) { return "Truncated record"; }
+        size_t end = at + length;
+
+        bool fits = true;
+        auto text = [&] {
+            size_t size = number(4, end);
+            if (end - at < size) {
+                fits = false;
+                return string();
+            }
+            at += size;
+            return content.substr(at - size, size);
+        };
+
+        sfcResult result;
+        result.name = text();
+        uint64_t flags = number(1, end);
+        result.isValid = flags & 1;
+        result.hasIssues = flags & 2;
+        result.hasSevereIssues = flags & 4;
+        result.title = text();
+        result.mapper = text();
+        result.imageSize = number(8, end);
+        result.realSize = number(8, end);
+        result.checksum = (uint16_t)number(2, end);
+        result.correctedChecksum = (uint16_t)number(2, end);
+        result.report = text();
+        if (!fits || at != end) { return "Malformed record"; }
+        results.push_back(std::move(result));
+    }
+    return string();
+}
+
+// Only what encodeResult writes: one flat object per line with string, number and boolean values
+string decodeJson(const string& content, vector<sfcResult>& results) {
+    size_t at = 0;
+    auto skipSpace = [&] {
+        while (at < content.size() && (content[at] == ' ' || content[at] == '\t' || content[at] == '\r' || content[at] == '\n')) {
+            ++at;
+        }
+    };
+    auto parseString = [&](string& value) {
+        if (at >= content.size() || content[at] != '"') { return false; }
+        for (++at; at < content.size() && content[at] != '"'; ++at) {
+            if (content[at] != '\\') {
+                value += content[at];
+                continue;
+            }
+            if (++at >= content.size()) { return false; }
+            switch (content[at]) {
+            case 'n':
+                value += '\n';
+                break;
+            case 't':
+                value += '\t';
+                break;
+            case 'r':
+                value += '\r';
+                break;
+            case 'b':
+                value += '\b';
+                break;
+            case 'f':
+                value += '\f';
+                break;
+            case 'u': {
+                if (content.size() - at < 5 || !all_of(&content[at + 1], &content[at + 5], [](unsigned char c) { return isxdigit(c); })) {
+                    return false;
+                }
+                unsigned code = (unsigned)stoul(content.substr(at + 1, 4), nullptr, 16);
+                at += 4;
+                if (code < 0x80) {
+                    value += (char)code;
+                } else if (code < 0x800) {
+                    value += (char)(0xc0 | code >> 6);
+                    value += (char)(0x80 | (code & 0x3f));
+                } else {
+                    value += (char)(0xe0 | code >> 12);
+                    value += (char)(0x80 | (code >> 6 & 0x3f));
+                    value += (char)(0x80 | (code & 0x3f));
+                }
+                break;
+            }
+            default:
+                value += content[at];
+                break;
+            }
+        }
+        if (at >= content.size()) { return false; }
+        ++at;
+        return true;
+    };
+
+    for (skipSpace(); at < content.size(); skipSpace()) {
+        if (content[at] != '{') { return "Malformed record"; }
+        ++at;
+        sfcResult result;
+        for (skipSpace(); at < content.size() && content[at] != '}'; skipSpace()) {
+            string key, text;
+            uint64_t number = 0;
+            bool boolean = false;
+            if (!parseString(key)) { return "Malformed record"; }
+            skipSpace();
+            if (at >= content.size() || content[at++] != ':') { return "Malformed record"; }
+            skipSpace();
+            if (at < content.size() && content[at] == '"') {
+                if (!parseString(text)) { return "Malformed record"; }
+            } else if (content.compare(at, 4, "true") == 0) {
+                boolean = true;
+                at += 4;
+            } else if (content.compare(at, 5, "false") == 0) {
+                at += 5;
+            } else {
+                size_t end = at;
+                while (end < content.size() && isdigit((unsigned char)content[end])) {
+                    ++end;
+                }
+                if (end == at) { return "Malformed record"; }
+                number = stoull(content.substr(at, end - at));
+                at = end;
+            }
+
+            if (key == "name") { result.name = text; }
+            if (key == "valid") { result.isValid = boolean; }
+            if (key == "issues") { result.hasIssues = boolean; }
+            if (key == "severe") { result.hasSevereIssues = boolean; }
+            if (key == "title") { result.title = text; }
+            if (key == "mapper") { result.mapper = text; }
+            if (key == "imageSize") { result.imageSize = number; }
+            if (key == "realSize") { result.realSize = number; }
+            if (key == "checksum") { result.checksum = (uint16_t)number; }
+            if (key == "correctedChecksum") { result.correctedChecksum = (uint16_t)number; }
+            if (key == "report") { result.report = text; }
+
+            skipSpace();
+            if (at < content.size() && content[at] == ',') { ++at; }
+        }
+        if (at >= content.size()) { return "Truncated record"; }
+        ++at;
+        results.push_back(std::move(result));
+    }
+    return string();
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "sfcFile.hpp"
+#include "sfcRing.hpp"
+
+struct sfcRom;
+
+// What checking one image found, as kept in result files
+struct sfcResult {
+    std::string name; // Path relative to the directory it was found in, or as given
+    bool isValid = false;
+    bool hasIssues = false;
+    bool hasSevereIssues = false;
+    std::string title;
+    std::string mapper;
+    uint64_t imageSize = 0;
+    uint64_t realSize = 0;
+    uint16_t checksum = 0;
+    uint16_t correctedChecksum = 0;
+    std::string report; // Text printed for the image (including what was fixed)
+};
+
+enum class sfcResultFormat { ndjson, binary };
+
+// Record for a checked image
+sfcResult makeResult(const std::string& name, const sfcRom& rom, const std::string& report);
+
+// Fixed-size record for a checked image, as published to a result ring
+sfcRingRecord makeRingRecord(const std::string& name, const sfcRom& rom);
+
+// Result file format implied by file extension (".ndjson", ".jsonl" or ".json" for NDJSON, anything else binary)
+sfcResultFormat resultFormat(const std::string& path);
+
+// Start of a result file, written before the first record
+std::string resultsHeader(sfcResultFormat format);
+
+// One record: a line of JSON, or a length-prefixed binary record
+std::string encodeResult(const sfcResult& result, sfcResultFormat format);
+
+// Records of a result file in either format (told apart by content)
+// Returns a description of the problem if the file can't be read or is malformed
+std::string readResults(const std::string& path, std::vector<sfcResult>& results);
+std::string decodeResults(const std::string& content, std::vector<sfcResult>& results);
+
+// Results of a long batch run kept in a binary result file as images are done, named by their full path
+// Records are collected from any thread and written out (and synced) about once a second,
+// so an interrupted run loses little work and can be resumed from the file
+struct sfcCheckpoint {
+    ~sfcCheckpoint() { flush(); }
+
+    // Start a new checkpoint at path, or with `resume` continue one, keeping the records it holds up to anything
+    // cut short. Returns a description of the problem if the file can't be written.
+    std::string open(const std::string& path, bool resume);
+
+    // Result of an image that was done before resuming, if any
+    const sfcResult* find(const std::string& path) const;
+
+    void add(const sfcResult& result);
+    void flush();
+
+  private:
+    sfcFile file;
+    std::unordered_map<std::string, sfcResult> resumed;
+    std::mutex lock;
+    std::string pending;
+    std::chrono::steady_clock::time_point lastWrite;
+};
@@ -0,0 +1,102 @@
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <string>
+
+#include "sfcRing.hpp"
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+using namespace std;
+
+sfcRingWriter::~sfcRingWriter() {
+#ifndef _WIN32
+    if (header) { ::munmap(header, size); }
+#endif
+}
+
+string sfcRingWriter::open(const string& name, uint32_t capacity) {
+#ifdef _WIN32
+    return "Result rings aren't supported on Windows";
+#else
+    uint32_t slots = 1;
+    while (slots < capacity && slots < 0x80000000u) {
+        slots <<= 1;
+    }
+    size = sizeof(sfcRingHeader) + (size_t)slots * sizeof(sfcRingSlot);
+
+    // Readers still attached to a ring of an earlier run keep it until they open this one
+    ::shm_unlink(name.c_str());
+    int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    void* memory = MAP_FAILED;
+    if (fd >= 0 && ::ftruncate(fd, (off_t)size) == 0) { memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0); }
+    if (fd >= 0) { ::close(fd); }
+    if (memory == MAP_FAILED) {
+        ::shm_unlink(name.c_str());
+        return "Cannot create result ring \"" + name + "\"";
+    }
+
+    // The memory starts out zeroed, readers only take the ring once the magic number is in place
+    header = new (memory) sfcRingHeader{0, sfcRingVersion, sizeof(sfcRingSlot), slots, {0}};
+    this->slots = (sfcRingSlot*)((uint8_t*)memory + sizeof(sfcRingHeader));
+    header->magic.store(sfcRingMagic, memory_order_release);
+    return string();
+#endif
+}
+
+void sfcRingWriter::publish(const sfcRingRecord& record) {
+    if (!header) { return; }
+    lock_guard<mutex> guard(lock);
+    uint64_t position = header->published.load(memory_order_relaxed);
+    sfcRingSlot& slot = slots[position & (header->capacity - 1)];
+    slot.sequence.store(2 * position + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy((void*)&slot.record, &record, sizeof(record));
+    slot.sequence.store(2 * position + 2, memory_order_release);
+    header->published.store(position + 1, memory_order_release);
+}
+
+sfcRingReader::~sfcRingReader() {
+#ifndef _WIN32
+    if (header) { ::munmap((void*)header, size); }
+#endif
+}
+
+string sfcRingReader::open(const string& name, bool latest) {
+#ifdef _WIN32
+    return "Result rings aren't supported on Windows";
+#else
+    int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    struct stat info = {};
+    void* memory = MAP_FAILED;
+    if (fd >= 0 && ::fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(sfcRingHeader)) {
+        size = (size_t)info.st_size;
+        memory = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    if (fd >= 0) { ::close(fd); }
+    if (memory == MAP_FAILED) { return "Cannot open result ring \"" + name + "\""; }
+
+    auto* shared = (const sfcRingHeader*)memory;
+    uint32_t capacity = shared->capacity;
+    if (shared->magic.load(memory_order_acquire) != sfcRingMagic || shared->version != sfcRingVersion || shared->slotSize != sizeof(sfcRingSlot) ||
+        capacity == 0 || (capacity & (capacity - 1)) || size < sizeof(sfcRingHeader) + (size_t)capacity * sizeof(sfcRingSlot)) {
+        ::munmap(memory, size);
+        return "\"" + name + "\" is not a result ring of this version";
+    }
+    header = shared;
+    slots = (const sfcRingSlot*)((const uint8_t*)memory + sizeof(sfcRingHeader));
+
+    uint64_t published = header->published.load(memory_order_acquire);
+    position = latest ? published : published - min<uint64_t>(published, capacity);
+    return string();
+#endif
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// Results of checked images published in POSIX shared memory, for services on the same machine to pick up without
+// a round trip. One writer (the checker) fills a ring of fixed-size records, any number of readers follow it.
+// The writer never waits for readers: a reader that falls a whole ring behind misses the records overwritten.
+// Reading is plain loads from the shared mapping, no copies or system calls. Only opening a ring needs the OS.
+
+// Findings of an image, as bits of sfcRingRecord::flags
+enum sfcRingFlag : uint32_t {
+    sfcRingValid = 1 << 0,
+    sfcRingIssues = 1 << 1,
+    sfcRingSevereIssues = 1 << 2,
+    sfcRingCopierHeader = 1 << 3,
+    sfcRingCorrectTitle = 1 << 4,
+    sfcRingCorrectRamSize = 1 << 5,
+    sfcRingCorrectChecksum = 1 << 6,
+    sfcRingLegalMode = 1 << 7,
+    sfcRingKnownMapper = 1 << 8,
+    sfcRingNewFormatHeader = 1 << 9,
+    sfcRingPatched = 1 << 10,
+    sfcRingInterleaved = 1 << 11,
+    sfcRingFast = 1 << 12,
+    sfcRingHasRam = 1 << 13,
+};
+
+// One image's result: the numeric fields of sfcRom, its findings as flags, and the path it was checked at
+struct sfcRingRecord {
+    uint64_t imageSize = 0;
+    uint64_t realSize = 0;
+    uint64_t headerLocation = 0;
+    uint64_t imageOffset = 0;
+    uint32_t flags = 0;
+    uint16_t checksum = 0;
+    uint16_t complement = 0;
+    uint16_t correctedChecksum = 0;
+    uint16_t correctedComplement = 0;
+    uint8_t mode = 0;
+    uint8_t mapper = 0;
+    uint8_t chipset = 0;
+    uint8_t chipsetSubtype = 0;
+    uint8_t romSize = 0;
+    uint8_t ramSize = 0;
+    uint8_t countryCode = 0;
+    uint8_t correctedMode = 0;
+    uint8_t correctedRomSize = 0;
+    uint8_t reserved[3] = {};
+    char name[200] = {}; // Zero terminated, the end of longer paths
+};
+static_assert(sizeof(sfcRingRecord) == 256);
+
+// Start of the shared memory, followed by the slots
+struct sfcRingHeader {
+    std::atomic<uint32_t> magic; // sfcRingMagic once the ring is set up
+    uint32_t version;
+    uint32_t slotSize;
+    uint32_t capacity;                          // Slots, a power of two
+    alignas(64) std::atomic<uint64_t> published; // Records written so far
+};
+
+struct sfcRingSlot {
+    std::atomic<uint64_t> sequence; // 2n + 1 while record n is written, 2n + 2 once it's complete
+    sfcRingRecord record;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring counters must work across processes");
+
+constexpr uint32_t sfcRingMagic = 0x47524653; // "SFRG"
+constexpr uint32_t sfcRingVersion = 1;
+
+struct sfcRingWriter {
+    sfcRingWriter() = default;
+    ~sfcRingWriter();
+
+    sfcRingWriter(const sfcRingWriter&) = delete;
+    sfcRingWriter& operator=(const sfcRingWriter&) = delete;
+
+    // Create the ring `name` (eg. "/superfamicheck") with room for `capacity` records (rounded up to a power of two),
+    // replacing one left by an earlier run. Returns a description of the problem if it can't be set up.
+    std::string open(const std::string& name, uint32_t capacity = 4096);
+    bool isOpen() const { return header != nullptr; }
+
+    // Publish a record (from any thread, one at a time)
+    void publish(const sfcRingRecord& record);
+
+  private:
+    sfcRingHeader* header = nullptr;
+    sfcRingSlot* slots = nullptr;
+    size_t size = 0;
+    std::mutex lock;
+};
+
+struct sfcRingReader {
+    sfcRingReader() = default;
+    ~sfcRingReader();
+
+    sfcRingReader(const sfcRingReader&) = delete;
+    sfcRingReader& operator=(const sfcRingReader&) = delete;
+
+    // Follow the ring `name` from the oldest record still in it, or with `latest` from the next one published
+    // Returns a description of the problem if there's no such ring
+    std::string open(const std::string& name, bool latest = false);
+    bool isOpen() const { return header != nullptr; }
+
+    // Next record in place in the ring, nullptr while there is none. The writer may overwrite it while it's in use,
+    // so what's read from it only counts if advance() then confirms it was intact.
+    const sfcRingRecord* peek();
+
+    // Move past the record peek() returned, false if it was overwritten meanwhile
+    bool advance();
+
+    // Copy of the next record, false while there is none
+    bool next(sfcRingRecord& record);
+
+    // Records overwritten before they were read
+    uint64_t missed = 0;
+
+  private:
+    const sfcRingHeader* header = nullptr;
+    const sfcRingSlot* slots = nullptr;
+    size_t size = 0;
+    uint64_t position = 0;
+};
+
+inline const sfcRingRecord* sfcRingReader::peek() {
+    uint64_t capacity = header->capacity;
+    while (true) {
+        uint64_t published = header->published.load(std::memory_order_acquire);
+        if (position == published) { return nullptr; }
+        if (published - position > capacity) {
+            missed += published - capacity - position;
+            position = published - capacity;
+        }
+        const sfcRingSlot& slot = slots[position & (capacity - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) == 2 * position + 2) { return &slot.record; }
+        ++missed;
+        ++position;
+    }
+}
+
+inline bool sfcRingReader::advance() {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const sfcRingSlot& slot = slots[position & (header->capacity - 1)];
+    bool intact = slot.sequence.load(std::memory_order_relaxed) == 2 * position + 2;
+    if (!intact) { ++missed; }
+    ++position;
+    return intact;
+}
+
+inline bool sfcRingReader::next(sfcRingRecord& record) {
+    for (const sfcRingRecord* current; (current = peek());) {
+        record = *current;
+        if (advance()) { return true; }
+    }
+    return false;
+}
@@ -1,13 +1,22 @@
+#include <algorithm>
 #include <climits>
 #include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <span>
 #include <string>
 #include <vector>
 
+#include "sfcCrc.hpp"
+#include "sfcFile.hpp"
+#include "sfcPatch.hpp"
+#include "sfcReader.hpp"
 #include "sfcRom.hpp"
+#include "sfcZip.hpp"
+#include "sfcZstd.hpp"
 
 using namespace std;
 
@@ -15,35 +24,81 @@ bool validResetOpcode(uint8_t op);
 bool validInterruptOpcode(uint8_t op);
 string sjisToString(uint8_t code);
 uint16_t getWord(const vector<uint8_t>& vec, size_t offset);
-void putWord(vector<uint8_t>& vec, size_t offset, uint16_t value);
+void putWord(sfcImage& image, size_t offset, uint16_t value);
 
-sfcRom::sfcRom(const string& path)
+sfcRom::sfcRom(const string& path, const sfcReadOptions& options)
     : filepath(path) {
 
-    int issues = 0;
+    // A patch needs the complete image
+    bool retain = options.retainImage || !options.patchPath.empty();
 
-    // Read file into buffer
-    image = vector<uint8_t>(0);
-    {
-        ifstream file(path, ios::binary | ios::ate);
-        if (file) {
-            size_t fileSize = file.tellg();
-            if ((fileSize & 0x3ff) == 0x200) {
-                hasCopierHeader = true;
-                imageOffset = 0x200;
-                ++issues;
-            }
+    // Read file, summing banks as it streams in
+    if (isZipPath(path)) {
+        image = readZip(path, retain, error);
+    } else if (isZstdPath(path)) {
+        image = readZstd(path, retain, options.quick, error);
+    } else {
+        image = readFile(path, retain, error, options.keepCache);
+    }
+    if (!error.empty() || image.size() == 0) { return; }
 
-            imageSize = fileSize - imageOffset;
-            if (imageSize < 0x8000 || imageSize > 0xc00000 || imageSize % 0x8000 != 0) { return; }
+    if (!options.patchPath.empty() && !patch(options.patchPath)) { return; }
+    analyze();
+}
 
-            file.seekg(imageOffset, ios::beg);
-            image.resize(imageSize);
-            file.read((char*)&image[0], imageSize);
-        } else {
-            return;
-        }
+sfcRom::sfcRom(const vector<string>& parts, const sfcReadOptions& options)
+    : partCount(parts.size()),
+      filepath(parts.empty() ? string() : parts.front()) {
+    if (parts.empty()) { return; }
+
+    image = readParts(parts, options.retainImage || !options.patchPath.empty(), error, options.keepCache);
+    if (!error.empty() || image.size() == 0) { return; }
+
+    if (!options.patchPath.empty() && !patch(options.patchPath)) { return; }
+    analyze();
+}
+
+sfcRom::sfcRom(const string& name, sfcImage&& streamedImage)
+    : filepath(name),
+      image(std::move(streamedImage)) {
+    analyze();
+}
+
+sfcRom::sfcRom(span<const uint8_t> bytes, const string& name)
+    : filepath(name),
+      image(readMemory(bytes)) {
+    if (image.size() == 0) { return; }
+    analyze();
+}
+
+// Apply patch, only re-summing the banks it touches
+bool sfcRom::patch(const string& patchPath) {
+    ifstream file(patchPath, ios::binary | ios::ate);
+    if (!file) {
+        error = "Cannot open patch \"" + patchPath + "\"";
+        return false;
     }
+    vector<uint8_t> patch((size_t)file.tellg());
+    file.seekg(0, ios::beg);
+    file.read((char*)patch.data(), patch.size());
+
+    string patchError = applyPatch(patch, image);
+    if (!patchError.empty()) {
+        error = "Cannot apply patch \"" + patchPath + "\": " + patchError;
+        return false;
+    }
+    isPatched = true;
+    return true;
+}
+
+void sfcRom::analyze() {
+    hasCopierHeader = !image.copierHeader.empty();
+    imageOffset = image.copierHeader.size();
+    imageSize = image.size();
+    realSize = imageSize;
+    if (!validImageSize(imageSize)) { return; }
+
+    int issues = hasCopierHeader ? 1 : 0;
 
     // Review possible header locations and pick best match
     {
@@ -62,12 +117,24 @@ sfcRom::sfcRom(const string& path)
             }
         }
 
+        // Interleaved HiROM images have their header where LoROM images do, so the HiROM header
+        // is only scored in de-interleaved coordinates when that one claims HiROM (or nothing was found)
+        if ((headerLocation == 0 || (headerLocation == 0x7fb0 && (image[0x7fd5] & 0x0f) == 0x1)) && imageSize % 0x10000 == 0 &&
+            imageSize <= 0x400000) {
+            if (scoreHeaderLocation(0xffb0, true) > -2) {
+                image.deinterleave();
+                headerLocation = 0xffb0;
+                isInterleaved = true;
+                ++issues;
+            }
+        }
+
         if (headerLocation == 0) { return; }
         isValid = true;
     }
 
     // We're probably dealing with an SFC ROM image
-    getHeaderInfo(vector<uint8_t>(image.begin() + headerLocation, image.begin() + headerLocation + 0x50));
+    getHeaderInfo(headerBytes(headerLocation));
 
     // Check title
     {
@@ -98,16 +165,23 @@ sfcRom::sfcRom(const string& path)
         }
     }
 
+    // Check for overdump, data past the declared ROM size that is only padding or mirrors
+    if (romSize >= 0x05 && romSize <= 0x0f && imageSize > ((size_t)1 << (romSize + 10))) {
+        size_t headerEnd = (headerLocation + 0x50 + sfcBankSize - 1) / sfcBankSize * sfcBankSize;
+        realSize = max({minimalSize(), (size_t)1 << (romSize + 10), headerEnd});
+        if (realSize < imageSize) { ++issues; }
+    }
+
     // Check ROM size
     {
-        if (imageSize > (1 << (romSize + 10)) || imageSize <= (1 << (romSize + 9))) {
-            uint32_t pot = imageSize;
+        if (realSize > (1 << (romSize + 10)) || realSize <= (1 << (romSize + 9))) {
+            uint32_t pot = realSize;
             int potN = 0;
             while (pot >>= 1) {
                 if (pot & 1) { ++potN; }
             }
             correctedRomSize = (potN > 1) ? 1 : 0;
-            uint32_t sizeBits = imageSize >> 10;
+            uint32_t sizeBits = realSize >> 10;
             while (sizeBits >>= 1) {
                 ++correctedRomSize;
             }
@@ -144,8 +218,9 @@ string sfcRom::description(bool silent) const {
         os << setfill('0') << hex;
 
         if (!silent) {
-            os << "ROM info for file \"" << filepath << "\""
-               << "\n\n";
+            os << "ROM info for file \"" << filepath << "\"";
+            if (partCount > 1) { os << " (" << dec << partCount << hex << " parts)"; }
+            os << "\n\n";
 
             uint32_t headerAt = headerLocation + (hasNewFormatHeader ? 0 : 0x10);
             os << "  Header at   0x" << setw(4) << headerAt << '\n';
@@ -238,10 +313,16 @@ string sfcRom::description(bool silent) const {
                 os << "  Checksum/complement should be 0x" << setw(4) << correctedChecksum << "/0x" << setw(4)
                    << correctedComplement << '\n';
             }
+            if (realSize < imageSize) {
+                os << "  Image is overdumped, real size is " << dec << (realSize >> 10) << hex << "KB" << '\n';
+            }
             if (hasCopierHeader) { os << "  File has a copier header (0x200 bytes)" << '\n'; }
+            if (isInterleaved) { os << "  Image is interleaved" << '\n'; }
             if (!silent) { os << '\n'; }
         }
 
+    } else if (!error.empty()) {
+        os << error << '\n';
     } else {
         os << "File \"" << filepath << "\" is not an SFC ROM image" << '\n';
     }
@@ -253,27 +334,142 @@ string sfcRom::fix(const string& path, bool silent) {
 
     ostringstream os;
 
-    int fixedIssues = 0;
-    if (checksum != correctedChecksum || complement != correctedComplement) { ++fixedIssues; }
+    sfcPatchFormat format = patchFormat(path);
+    if (isInterleaved && format != sfcPatchFormat::none) {
+        error = "Cannot write patch \"" + path + "\", image is interleaved";
+        return error + '\n';
+    }
+    bool inPlace = fixesInPlace(path);
+    if (!image.retained() && fixNeedsImage(path)) {
+        error = "Cannot write \"" + path + "\", image was not kept in memory";
+        return error + '\n';
+    }
+    vector<uint8_t> originalHeader = headerBytes(headerLocation);
+    size_t sourceSize = image.copierHeader.size() + image.size();
+    uint32_t sourceCrc = 0;
+    if (format == sfcPatchFormat::bps) {
+        sourceCrc = crc32(image.copierHeader.data(), image.copierHeader.size());
+        sourceCrc = crc32(image.data.data(), image.size(), sourceCrc);
+    }
 
-    if (!silent) { os << "Writing ROM image to file \"" << path << "\"" << '\n'; }
+    if (!silent) {
+        string destination = path == "-" ? "stdout" : "file \"" + path + "\"";
+        switch (format) {
+        case sfcPatchFormat::ips:
+            os << "Writing IPS patch to " << destination << '\n';
+            break;
+        case sfcPatchFormat::bps:
+            os << "Writing BPS patch to " << destination << '\n';
+            break;
+        default:
+            os << "Writing ROM image to " << destination << '\n';
+            break;
+        }
+    }
 
     if (hasCopierHeader) {
-        if (!silent) { os << "  Removed copier header" << '\n'; }
+        if (!silent) {
+            if (format == sfcPatchFormat::ips) {
+                os << "  Patch applies to image without copier header" << '\n';
+            } else {
+                os << "  Removed copier header" << '\n';
+            }
+        }
+    }
+
+    if (isInterleaved && !silent) { os << "  De-interleaved image" << '\n'; }
+
+    if (realSize < imageSize && !silent) { os << "  Trimmed image to " << (realSize >> 10) << "KB" << '\n'; }
+
+    int fixedIssues = fixHeader(os, silent);
+
+    if (fixedIssues || hasCopierHeader || isPatched || isInterleaved || realSize < imageSize || path != filepath || path == "-") {
+        // Writing the image over an archive or the first of its parts would lose the rest
+        if (path == filepath && (isZipPath(path) || isZstdPath(path) || partCount > 1)) {
+            error = "Cannot fix \"" + path + "\" in place, it isn't a plain image file";
+            return error + '\n';
+        }
+        vector<uint8_t> patch;
+        if (format != sfcPatchFormat::none) {
+            // Fixes only ever touch the header, so that's the only window to diff
+            vector<uint8_t> fixedHeader = headerBytes(headerLocation);
+            auto records = diffRecords(originalHeader.data(), fixedHeader.data(), originalHeader.size(), headerLocation);
+            if (format == sfcPatchFormat::ips) {
+                patch = makeIpsPatch(records, realSize < imageSize ? realSize : 0);
+            } else {
+                patch = makeBpsPatch(
+                    records, sourceSize, imageOffset, sourceCrc, realSize, crc32(image.data.data(), realSize)
+                );
+            }
+        }
+
+        sfcFile file(path, inPlace ? sfcFileMode::update : sfcFileMode::create);
+        bool written = false;
+        if (file.isOpen()) {
+            if (inPlace) {
+                vector<uint8_t> fixedHeader = headerBytes(headerLocation);
+                written = file.writeAt(headerLocation, fixedHeader.data(), fixedHeader.size()) &&
+                          (realSize == imageSize || file.truncate(realSize));
+            } else if (format == sfcPatchFormat::none) {
+                written = file.write(image.data.data(), realSize * sizeof(uint8_t));
+            } else {
+                written = file.write(patch.data(), patch.size());
+            }
+        }
+        if (!written) {
+            error = "Cannot open file \"" + path + "\" for writing";
+            return error + '\n';
+        }
+    } else {
+        return string();
+    }
+
+    if (!silent) { os << '\n'; }
+    return os.str();
+}
+
+string sfcRom::fix(span<uint8_t> bytes, bool silent) {
+    if (!isValid) { return string(); }
+
+    ostringstream os;
+    vector<uint8_t> originalHeader = headerBytes(headerLocation);
+    size_t location = imageOffset + headerLocation;
+    if (bytes.size() != imageOffset + imageSize || !equal(originalHeader.begin(), originalHeader.end(), bytes.begin() + location)) {
+        os << "Cannot fix \"" << filepath << "\" in memory, it isn't the content that was checked" << '\n';
+        return os.str();
+    }
+    if (isPatched || isInterleaved || realSize < imageSize) {
+        const char* needs = isPatched ? "a patch applied" : isInterleaved ? "de-interleaving" : "trimming";
+        os << "Cannot fix \"" << filepath << "\" in memory, it needs " << needs << '\n';
+        return os.str();
     }
 
+    if (!silent) { os << "Fixing \"" << filepath << "\" in memory" << '\n'; }
+    if (!fixHeader(os, silent)) { return string(); }
+    vector<uint8_t> fixedHeader = headerBytes(headerLocation);
+    copy(fixedHeader.begin(), fixedHeader.end(), bytes.begin() + location);
+
+    if (!silent) { os << '\n'; }
+    return os.str();
+}
+
+// Correct the header in the image, returns how many issues that fixed
+int sfcRom::fixHeader(ostream& os, bool silent) {
+    int fixedIssues = 0;
+    if (checksum != correctedChecksum || complement != correctedComplement) { ++fixedIssues; }
+
     if (!hasCorrectTitle) {
         // TODO
     }
 
     if (!hasLegalMode) {
-        image[headerLocation + 0x25] = correctedMode;
+        image.put(headerLocation + 0x25, correctedMode);
         ++fixedIssues;
         if (!silent) { os << "  Fixed ROM makeup" << '\n'; }
     }
 
     if (correctedRomSize && romSize != correctedRomSize) {
-        image[headerLocation + 0x27] = correctedRomSize;
+        image.put(headerLocation + 0x27, correctedRomSize);
         ++fixedIssues;
         if (!silent) { os << "  Fixed ROM size" << '\n'; }
     }
@@ -285,29 +481,26 @@ string sfcRom::fix(const string& path, bool silent) {
         putWord(image, headerLocation + 0x2e, correctedChecksum);
         if (!silent) { os << "  Fixed checksum" << '\n'; }
     }
+    return fixedIssues;
+}
 
-    if (fixedIssues || hasCopierHeader || path != filepath) {
-        ofstream file(path, ios::binary | ios::trunc);
-        if (file && file.good()) {
-            file.write((char*)&image[0], image.size() * sizeof(uint8_t));
-        } else {
-            ostringstream fail;
-            fail << "Cannot open file \"" << path << "\" for writing" << '\n';
-            return fail.str();
-        }
-    } else {
-        return string();
-    }
+bool sfcRom::fixNeedsImage(const string& path) const {
+    // Trimming an image that wasn't kept would rely on bank sums alone to tell mirrors
+    return patchFormat(path) == sfcPatchFormat::bps ||
+           (patchFormat(path) == sfcPatchFormat::none && !(fixesInPlace(path) && realSize == imageSize));
+}
 
-    if (!silent) { os << '\n'; }
-    return os.str();
+// A plain file fixed in place only gets its header rewritten, and is cut off when trimmed
+bool sfcRom::fixesInPlace(const string& path) const {
+    return patchFormat(path) == sfcPatchFormat::none && path == filepath && path != "-" && !hasCopierHeader && !isPatched &&
+           !isInterleaved && partCount == 1 && !isZipPath(path) && !isZstdPath(path);
 }
 
-int sfcRom::scoreHeaderLocation(size_t loc) const {
+int sfcRom::scoreHeaderLocation(size_t loc, bool interleaved) const {
     if (image.size() < loc + 0x50) { return -100; }
 
     int score = 0;
-    vector<uint8_t> header = vector<uint8_t>(image.begin() + loc, image.begin() + loc + 0x50);
+    vector<uint8_t> header = headerBytes(loc, interleaved);
     uint16_t reset = getWord(header, 0x4c);
 
     // If 32K/bank mapper, reset vector must point to upper half
@@ -346,7 +539,7 @@ int sfcRom::scoreHeaderLocation(size_t loc) const {
     }
 
     // Reasonable reset opcode?
-    if (validResetOpcode(image[reset])) {
+    if (validResetOpcode(byteAt(reset, interleaved))) {
         score += 2;
     } else {
         score -= 4;
@@ -355,6 +548,19 @@ int sfcRom::scoreHeaderLocation(size_t loc) const {
     return score;
 }
 
+// Byte of the image, or of the image as it would be de-interleaved
+uint8_t sfcRom::byteAt(size_t offset, bool interleaved) const {
+    return image[interleaved ? interleavedOffset(offset, image.size()) : offset];
+}
+
+vector<uint8_t> sfcRom::headerBytes(size_t location, bool interleaved) const {
+    vector<uint8_t> header(0x50);
+    for (size_t i = 0; i < header.size(); ++i) {
+        header[i] = byteAt(location + i, interleaved);
+    }
+    return header;
+}
+
 void sfcRom::getHeaderInfo(const vector<uint8_t>& header) {
     mode = header[0x25];
     mapper = mode & 0x0f;
@@ -580,41 +786,85 @@ void sfcRom::getHeaderInfo(const vector<uint8_t>& header) {
 }
 
 uint16_t sfcRom::calculateChecksum() const {
-    vector<uint8_t> img = image;
-    putWord(img, headerLocation + 0x2c, 0xffff);
-    putWord(img, headerLocation + 0x2e, 0x0000);
+    // The mapped image is described as ranges of the actual image, so mirrors are summed from bank sums without copying
+    vector<pair<size_t, size_t>> ranges = {{0, realSize}};
+    size_t mappedSoFar = realSize;
+
+    // Append mapped range [from, from + length) as another set of image ranges
+    auto mirror = [&](size_t from, size_t length) {
+        vector<pair<size_t, size_t>> mirrored;
+        size_t position = 0;
+        for (auto [offset, rangeLength] : ranges) {
+            size_t begin = max(position, from);
+            size_t end = min(position + rangeLength, from + length);
+            if (begin < end) { mirrored.emplace_back(offset + (begin - position), end - begin); }
+            position += rangeLength;
+        }
+        ranges.insert(ranges.end(), mirrored.begin(), mirrored.end());
+        mappedSoFar += length;
+    };
 
-    size_t imageSize = img.size();
     size_t mappedSize = 0;
 
     if (mapper == 0x0a && chipset == 0xf9 && chipsetSubtype == 0x00) {
         // Extended HiROM/SPC7110+RTC+Battery
-        mappedSize = imageSize;
+        mappedSize = realSize;
     } else if (mapper == 0x0a && chipset == 0xf5 && chipsetSubtype == 0x00) {
         // Extended HiROM/SPC7110+Battery
-        mappedSize = imageSize > 0x200000 ? imageSize << 1 : imageSize;
-        while (mappedSize > img.size()) {
-            size_t remaining = mappedSize - img.size();
-            if (remaining > image.size()) { remaining = image.size(); }
-            if ((remaining + img.size()) > mappedSize) { remaining = mappedSize - img.size(); }
-            vector<uint8_t> mirror(img.begin(), img.begin() + remaining);
-            img.insert(img.end(), mirror.begin(), mirror.end());
+        mappedSize = realSize > 0x200000 ? realSize << 1 : realSize;
+        while (mappedSize > mappedSoFar) {
+            mirror(0, min(mappedSize - mappedSoFar, realSize));
         }
     } else {
         // Standard mapping
-        mappedSize = 1 << (correctedRomSize != 0 ? correctedRomSize + 10 : romSize + 10);
-        while (mappedSize > img.size()) {
-            vector<uint8_t> mirror(img.begin() + (mappedSize >> 1), img.end());
-            img.insert(img.end(), mirror.begin(), mirror.end());
+        mappedSize = (size_t)1 << (correctedRomSize != 0 ? correctedRomSize + 10 : romSize + 10);
+        while (mappedSize > mappedSoFar && (mappedSize >> 1) < mappedSoFar) {
+            mirror(mappedSize >> 1, mappedSoFar - (mappedSize >> 1));
+        }
+    }
+
+    uint64_t sum = 0;
+    for (auto [offset, length] : ranges) {
+        sum += image.sum(offset, length);
+    }
+
+    // Checksum is calculated with complement/checksum set to 0xffff/0x0000
+    const uint8_t blankChecksum[4] = {0xff, 0xff, 0x00, 0x00};
+    for (size_t i = 0; i < 4; ++i) {
+        size_t location = headerLocation + 0x2c + i;
+        for (auto [offset, length] : ranges) {
+            if (location >= offset && location < offset + length) { sum += blankChecksum[i] - image[location]; }
         }
     }
+    return (uint16_t)sum;
+}
+
+// Smallest size the image can be cut down to: trailing banks of 0x00 or 0xff padding are dropped
+// (bank sums tell those exactly), as are upper halves that mirror the lower half
+size_t sfcRom::minimalSize() const {
+    size_t size = imageSize;
+    for (;;) {
+        if ((size & (size - 1)) == 0 && size >= 2 * sfcBankSize && mirrors(size >> 1)) {
+            size >>= 1;
+        } else if (size > sfcBankSize && (image.bankSums[size / sfcBankSize - 1] == 0 ||
+                                          image.bankSums[size / sfcBankSize - 1] == 0xff * sfcBankSize)) {
+            size -= sfcBankSize;
+        } else {
+            return size;
+        }
+    }
+}
 
-    uint16_t sum = 0;
-    size_t length = img.size();
-    for (size_t offset = 0; offset < length; ++offset) {
-        sum += img[offset];
+// Does [half, half * 2) repeat [0, half)? Bank sums rule out most images before any bytes are compared,
+// images that weren't kept in memory need matching bank CRCs instead (equal sums alone aren't enough to trim)
+bool sfcRom::mirrors(size_t half) const {
+    size_t banks = half / sfcBankSize;
+    for (size_t bank = 0; bank < banks; ++bank) {
+        if (image.bankSums[bank] != image.bankSums[banks + bank]) { return false; }
     }
-    return sum;
+    if (image.retained()) { return memcmp(image.data.data(), image.data.data() + half, half) == 0; }
+    if (image.bankCrcs.size() != image.bankSums.size()) { return false; }
+    return equal(image.bankCrcs.begin(), image.bankCrcs.begin() + banks, image.bankCrcs.begin() + banks);
 }
 
 // Get little endian word
@@ -623,9 +873,9 @@ uint16_t getWord(const vector<uint8_t>& vec, size_t offset) {
 }
 
 // Put little endian word
-void putWord(vector<uint8_t>& vec, size_t offset, uint16_t value) {
-    vec[offset] = (uint8_t)(value & 0xff);
-    vec[offset + 1] = (uint8_t)(value >> 8);
+void putWord(sfcImage& image, size_t offset, uint16_t value) {
+    image.put(offset, (uint8_t)(value & 0xff));
+    image.put(offset + 1, (uint8_t)(value >> 8));
 }
 
 // Opcodes used on reset
@@ -1,14 +1,44 @@
 #pragma once
 
 #include <cstdint>
+#include <iosfwd>
+#include <span>
 #include <string>
 #include <vector>
 
+#include "sfcImage.hpp"
+
+// How an image is read
+struct sfcReadOptions {
+    std::string patchPath;   // IPS/BPS patch to apply in memory
+    bool retainImage = true; // Keep the complete image (needed to fix), otherwise only header windows
+    bool quick = false;       // Take bank sums from the index of compressed images instead of decompressing
+    bool keepCache = true;    // Leave the file in the page cache after reading (when fixing right after)
+};
+
 struct sfcRom {
-    sfcRom(const std::string& path);
+    // Load image from a file, seekable zstd image or zip archive ("archive.zip" or "archive.zip/member.sfc")
+    sfcRom(const std::string& path, const sfcReadOptions& options = sfcReadOptions());
+
+    // Load split copier files (in order) as one image
+    sfcRom(const std::vector<std::string>& parts, const sfcReadOptions& options = sfcReadOptions());
+
+    // Check an image that was already read, named `name` in reports
+    sfcRom(const std::string& name, sfcImage&& streamedImage);
+
+    // Check a file's complete content in memory (copier header included) without copying it, named `name` in reports
+    // Only bank sums and header windows are kept, as for a streamed image, so `bytes` may go once this returns
+    sfcRom(std::span<const uint8_t> bytes, const std::string& name = std::string());
 
     std::string description(bool silent) const;
+    // Write fixed image to path, or an IPS/BPS patch if path ends in ".ips"/".bps"
+    // If it can't be written (or path is the archive or split set it was read from), error says why and is returned
     std::string fix(const std::string& path, bool silent);
+    // Whether fixing to path needs the complete image rather than just the header windows
+    bool fixNeedsImage(const std::string& path) const;
+    // Fix the header of the content this was checked from in place. A copier header is kept, and images that would
+    // need trimming, de-interleaving or a patch applied can't be fixed this way (the reason is returned instead).
+    std::string fix(std::span<uint8_t> bytes, bool silent);
 
     bool isValid = false;
     bool hasIssues = false;
@@ -21,6 +51,10 @@ struct sfcRom {
     bool hasLegalMode = false;
     bool hasKnownMapper = false;
     bool hasNewFormatHeader = false;
+    bool isPatched = false;
+    bool isInterleaved = false;
+
+    std::string error;
 
     std::string title;
     std::string mapperName;
@@ -45,7 +79,9 @@ struct sfcRom {
     uint16_t complement = 0;
 
     size_t imageSize = 0;
+    size_t realSize = 0; // Size without overdumped padding or mirrors
     size_t imageOffset = 0;
+    size_t partCount = 1;
     size_t headerLocation = 0;
 
     uint8_t correctedMode = 0;
@@ -55,9 +91,17 @@ struct sfcRom {
 
   private:
     std::string filepath;
-    std::vector<uint8_t> image;
+    sfcImage image;
 
+    bool patch(const std::string& patchPath);
+    int fixHeader(std::ostream& os, bool silent);
+    bool fixesInPlace(const std::string& path) const;
+    void analyze();
+    uint8_t byteAt(size_t offset, bool interleaved) const;
+    std::vector<uint8_t> headerBytes(size_t location, bool interleaved = false) const;
     void getHeaderInfo(const std::vector<uint8_t>& header);
-    int scoreHeaderLocation(size_t location) const;
+    int scoreHeaderLocation(size_t location, bool interleaved = false) const;
+    size_t minimalSize() const;
+    bool mirrors(size_t half) const;
     uint16_t calculateChecksum() const;
 };
@@ -0,0 +1,275 @@
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "sfcFile.hpp"
+#include "sfcReader.hpp"
+#include "sfcServe.hpp"
+#include "sfcZip.hpp"
+#include "sfcZstd.hpp"
+
+#ifndef _WIN32
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+#endif
+
+using namespace std;
+
+// Longest request line, and most file descriptors taken with one read
+constexpr size_t maxRequestLength = 0x1000;
+constexpr size_t maxPassedFiles = 4;
+
+// Largest file read whole into a worker's buffer (a 12MB image with copier header), bigger ones are streamed
+constexpr size_t maxBufferSize = 0xc00000 + 0x200;
+
+#ifndef _WIN32
+
+// A client's requests as they arrive, with the file descriptors passed along by where in the input they came
+struct sfcConnection {
+    int fd = -1;
+    string input;
+    deque<pair<size_t, int>> passed;
+    bool busy = false;   // A request is being checked, the next one waits
+    bool ended = false;  // The client sent all it will
+    bool failed = false; // Drop the connection
+};
+
+bool receive(sfcConnection& connection);
+bool sendAll(int fd, const string& data);
+sfcResult checkRequest(const string& name, int file, const sfcServeTask& task);
+
+#endif
+
+string serve(const string& socketPath, sfcTaskPool& pool, const sfcServeTask& task, int stop) {
+#ifdef _WIN32
+    return "Serving requests isn't supported on Windows";
+#else
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) { return "Socket path \"" + socketPath + "\" is too long"; }
+    memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+    // A socket left behind by an earlier run is replaced
+    struct stat info = {};
+    if (::lstat(socketPath.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) { ::unlink(socketPath.c_str()); }
+    int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    int wakeup[2] = {-1, -1};
+    if (listener < 0 || ::bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || ::listen(listener, SOMAXCONN) != 0 ||
+        ::pipe(wakeup) != 0) {
+        if (listener >= 0) { ::close(listener); }
+        return "Cannot listen on socket \"" + socketPath + "\"";
+    }
+
+    // Clients hanging up before their reply is sent don't end the server
+    signal(SIGPIPE, SIG_IGN);
+
+    // Workers hand connections back once their reply is sent, waking the main loop through the pipe
+    mutex lock;
+    vector<pair<int, bool>> answered;
+    unordered_map<int, sfcConnection> connections;
+    sfcTaskGroup requests(&pool);
+
+    // Start checking the next request of a connection that isn't busy, if it arrived in full
+    auto dispatch = [&](sfcConnection& connection) {
+        size_t end = connection.input.find('\n');
+        if (connection.busy || connection.failed || end == string::npos) {
+            if (connection.input.size() > maxRequestLength) { connection.failed = true; }
+            return;
+        }
+        string line = connection.input.substr(0, end);
+        connection.input.erase(0, end + 1);
+        if (!line.empty() && line.back() == '\r') { line.pop_back(); }
+
+        // The request takes the first descriptor that came with its line, any others are closed
+        int file = -1;
+        while (!connection.passed.empty() && connection.passed.front().first <= end) {
+            if (file < 0) {
+                file = connection.passed.front().second;
+            } else {
+                ::close(connection.passed.front().second);
+            }
+            connection.passed.pop_front();
+        }
+        for (auto& passed : connection.passed) {
+            passed.first -= end + 1;
+        }
+
+        size_t space = line.find(' ');
+        string format = line.substr(0, space);
+        string name = space == string::npos ? string() : line.substr(space + 1);
+        if ((format != "json" && format != "binary") || (name.empty() && file < 0)) {
+            sfcResult invalid;
+            invalid.name = name;
+            invalid.report = "Invalid request \"" + line.substr(0, 80) + "\", expected \"json PATH\" or \"binary PATH\"\n";
+            sendAll(connection.fd, encodeResult(invalid, sfcResultFormat::ndjson));
+            if (file >= 0) { ::close(file); }
+            connection.failed = true;
+            return;
+        }
+
+        connection.busy = true;
+        auto encoding = format == "json" ? sfcResultFormat::ndjson : sfcResultFormat::binary;
+        requests.run([&, client = connection.fd, file, name, encoding] {
+            string reply = encodeResult(checkRequest(name, file, task), encoding);
+            if (file >= 0) { ::close(file); }
+            bool sent = sendAll(client, reply);
+            lock_guard<mutex> guard(lock);
+            answered.emplace_back(client, sent);
+            char byte = 0;
+            ssize_t written = ::write(wakeup[1], &byte, 1);
+            (void)written;
+        });
+    };
+
+    string error;
+    while (error.empty()) {
+        // Without a stop descriptor its entry is negative, which poll passes over
+        vector<pollfd> waiting = {{listener, POLLIN, 0}, {wakeup[0], POLLIN, 0}, {stop, POLLIN, 0}};
+        for (const auto& [fd, connection] : connections) {
+            if (!connection.busy && !connection.ended) { waiting.push_back({fd, POLLIN, 0}); }
+        }
+        if (::poll(waiting.data(), waiting.size(), -1) < 0) {
+            if (errno != EINTR) { error = "Cannot wait for requests on socket \"" + socketPath + "\""; }
+            continue;
+        }
+        if (waiting[2].revents) { break; }
+
+        if (waiting[1].revents) {
+            char signals[64];
+            ssize_t drained = ::read(wakeup[0], signals, sizeof(signals));
+            (void)drained;
+            vector<pair<int, bool>> done;
+            {
+                lock_guard<mutex> guard(lock);
+                done.swap(answered);
+            }
+            for (auto [fd, sent] : done) {
+                sfcConnection& connection = connections[fd];
+                connection.busy = false;
+                if (!sent) { connection.failed = true; }
+                dispatch(connection);
+            }
+        }
+        if (waiting[0].revents & POLLIN) {
+            int client = ::accept(listener, nullptr, nullptr);
+            if (client >= 0) { connections[client].fd = client; }
+        }
+        for (size_t i = 3; i < waiting.size(); ++i) {
+            if (!waiting[i].revents) { continue; }
+            sfcConnection& connection = connections[waiting[i].fd];
+            if (!receive(connection)) { connection.ended = true; }
+            dispatch(connection);
+        }
+
+        // Connections are closed once they're done with, never while a worker still replies on one
+        for (auto it = connections.begin(); it != connections.end();) {
+            sfcConnection& connection = it->second;
+            bool done = connection.failed || (connection.ended && connection.input.find('\n') == string::npos);
+            if (connection.busy || !done) {
+                ++it;
+                continue;
+            }
+            for (auto [offset, file] : connection.passed) {
+                ::close(file);
+            }
+            ::close(connection.fd);
+            it = connections.erase(it);
+        }
+    }
+
+    requests.wait();
+    for (const auto& [fd, connection] : connections) {
+        ::close(fd);
+    }
+    ::close(listener);
+    ::close(wakeup[0]);
+    ::close(wakeup[1]);
+    return error;
+#endif
+}
+
+#ifndef _WIN32
+
+// Read what the client sent, false once it's done sending (or the connection failed)
+bool receive(sfcConnection& connection) {
+    char data[0x1000];
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * maxPassedFiles)];
+    iovec chunk = {data, sizeof(data)};
+    msghdr message = {};
+    message.msg_iov = &chunk;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t length = ::recvmsg(connection.fd, &message, 0);
+    if (length < 0 && (errno == EINTR || errno == EAGAIN)) { return true; }
+
+    for (cmsghdr* header = CMSG_FIRSTHDR(&message); length >= 0 && header; header = CMSG_NXTHDR(&message, header)) {
+        if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) { continue; }
+        size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; ++i) {
+            int file;
+            memcpy(&file, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+            connection.passed.emplace_back(connection.input.size(), file);
+        }
+    }
+    if (length <= 0) { return false; }
+    connection.input.append(data, (size_t)length);
+    return true;
+}
+
+bool sendAll(int fd, const string& data) {
+    for (size_t sent = 0; sent < data.size();) {
+        ssize_t length = ::send(fd, data.data() + sent, data.size() - sent, 0);
+        if (length < 0 && errno == EINTR) { continue; }
+        if (length <= 0) { return false; }
+        sent += (size_t)length;
+    }
+    return true;
+}
+
+// Check the image at path `name`, or in the passed file named `name`
+sfcResult checkRequest(const string& name, int file, const sfcServeTask& task) {
+    // Each worker keeps its buffer from one request to the next, so most images are read into memory already mapped
+    thread_local sfcBytes buffer;
+
+    sfcFile image;
+    if (file >= 0) {
+        image.fd = file;
+    } else if (!isZipPath(name) && !isZstdPath(name)) {
+        image = sfcFile(name);
+    }
+    size_t size = image.isOpen() ? image.size() : 0;
+
+    // Archives, pipes, large files and whatever can't be opened go the usual way
+    if (size == 0 || size > maxBufferSize) {
+        if (file < 0) {
+            sfcReadOptions options;
+            options.retainImage = false;
+            sfcRom rom(name, options);
+            return task(name, rom);
+        }
+        string error;
+        sfcRom rom(name, readOpenFile(image, name, false, error));
+        if (!error.empty()) { rom.error = error; }
+        return task(name, rom);
+    }
+
+    buffer.resize(size);
+    buffer.resize(image.readAt(0, buffer.data(), size));
+    sfcRom rom(span<const uint8_t>(buffer.data(), buffer.size()), name);
+    return task(name, rom);
+}
+
+#endif
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include "sfcResult.hpp"
+#include "sfcRom.hpp"
+#include "sfcTasks.hpp"
+
+// Makes the result for an image checked on request, named by its path or the name sent with its file
+using sfcServeTask = std::function<sfcResult(const std::string& name, sfcRom& rom)>;
+
+// Answer requests on a Unix domain socket at socketPath, checking images on pool's threads
+//
+// A request is a line "json PATH" or "binary PATH". When a file descriptor is passed with the line (SCM_RIGHTS),
+// the image is read from it and PATH only names it (and may be left out). The reply is the image's result record:
+// a line of JSON, or a binary record as in result files (32 bit length and fields, without the file header).
+// Requests on one connection are answered in order, different connections in parallel. A malformed request is
+// answered with a JSON record reporting it, and the connection is closed.
+//
+// Runs until the socket fails, returning a description of the problem, or until `stop` (eg. the read end of a pipe)
+// is readable or hung up, returning nothing once the requests being checked are answered
+std::string serve(const std::string& socketPath, sfcTaskPool& pool, const sfcServeTask& task, int stop = -1);
@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "sfcFile.hpp"
+#include "sfcImage.hpp"
+#include "sfcTar.hpp"
+
+using namespace std;
+
+constexpr size_t tarBlockSize = 512;
+constexpr size_t readChunkSize = 0x100000;
+
+bool tarChecksumValid(const uint8_t* header);
+bool tarNumber(const uint8_t* field, size_t length, size_t& value);
+string tarString(const uint8_t* field, size_t length);
+string paxPath(const vector<uint8_t>& records);
+
+string readTar(sfcFile& file, bool retain, const sfcTarMemberFunction& member) {
+    uint8_t header[tarBlockSize];
+    string longName;
+
+    while (true) {
+        size_t headerRead = file.read(header, tarBlockSize);
+        if (headerRead == 0) { return string(); }
+        if (headerRead != tarBlockSize) { return "Tar stream is truncated"; }
+
+        // End of archive is marked by zero blocks
+        if (all_of(header, header + tarBlockSize, [](uint8_t b) { return b == 0; })) { return string(); }
+        if (!tarChecksumValid(header)) { return "Tar stream is corrupt"; }
+
+        size_t size = 0;
+        if (!tarNumber(&header[124], 12, size)) { return "Tar stream is corrupt"; }
+        size_t padding = (tarBlockSize - size % tarBlockSize) % tarBlockSize;
+        char type = (char)header[156];
+
+        // GNU long names and pax headers carry the name of the following member
+        if (type == 'L' || type == 'x') {
+            if (size > 0x100000) { return "Tar stream is corrupt"; }
+            vector<uint8_t> data(size);
+            if (file.read(data.data(), size) != size || !file.skip(padding)) { return "Tar stream is truncated"; }
+            string name = type == 'L' ? tarString(data.data(), data.size()) : paxPath(data);
+            if (!name.empty()) { longName = name; }
+            continue;
+        }
+
+        string name = longName;
+        longName.clear();
+        if (name.empty()) {
+            name = tarString(&header[0], 100);
+            string prefix = tarString(&header[345], 155);
+            if (equal(&header[257], &header[262], "ustar") && !prefix.empty()) { name = prefix + "/" + name; }
+        }
+
+        size_t headerSize = (size & 0x3ff) == 0x200 ? 0x200 : 0;
+        bool regular = type == '0' || type == '\0' || type == '7';
+        if (!regular || !validImageSize(size - headerSize)) {
+            if (!file.skip(size + padding)) { return "Tar stream is truncated"; }
+            continue;
+        }
+
+        sfcImageBuilder builder(size, retain);
+        while (!builder.complete()) {
+            size_t chunk = readChunkSize;
+            uint8_t* destination = builder.buffer(chunk);
+            if (file.read(destination, chunk) != chunk) { return "Tar stream is truncated"; }
+            builder.commit(chunk);
+        }
+        if (!file.skip(padding)) { return "Tar stream is truncated"; }
+
+        member(name, builder.finish());
+    }
+}
+
+bool tarChecksumValid(const uint8_t* header) {
+    size_t stored = 0;
+    if (!tarNumber(&header[148], 8, stored)) { return false; }
+    size_t sum = 0;
+    for (size_t i = 0; i < tarBlockSize; ++i) {
+        sum += (i >= 148 && i < 156) ? ' ' : header[i];
+    }
+    return sum == stored;
+}
+
+// Octal, or base-256 if the high bit of the first byte is set (GNU)
+bool tarNumber(const uint8_t* field, size_t length, size_t& value) {
+    value = 0;
+    if (field[0] & 0x80) {
+        for (size_t i = 0; i < length; ++i) {
+            value = (value << 8) | (i == 0 ? field[i] & 0x7f : field[i]);
+        }
+        return true;
+    }
+    size_t i = 0;
+    while (i < length && field[i] == ' ') {
+        ++i;
+    }
+    for (; i < length && field[i] >= '0' && field[i] <= '7'; ++i) {
+        value = (value << 3) | (field[i] - '0');
+    }
+    return i == length || field[i] == ' ' || field[i] == '\0';
+}
+
+string tarString(const uint8_t* field, size_t length) {
+    return string((const char*)field, find(field, field + length, 0) - field);
+}
+
+// Path from pax extended header records ("<length> path=<value>\n")
+string paxPath(const vector<uint8_t>& records) {
+    string text(records.begin(), records.end());
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t space = text.find(' ', pos);
+        if (space == string::npos) { break; }
+        size_t length = 0;
+        auto result = from_chars(text.data() + pos, text.data() + space, length);
+        if (result.ec != errc() || length <= space - pos + 1 || pos + length > text.size()) { break; }
+        string record = text.substr(space + 1, pos + length - space - 2);
+        if (record.starts_with("path=")) { return record.substr(5); }
+        pos += length;
+    }
+    return string();
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include "sfcFile.hpp"
+#include "sfcImage.hpp"
+
+// Called with each tar member that has a valid ROM image size, as soon as it has been read
+using sfcTarMemberFunction = std::function<void(const std::string& name, sfcImage&& image)>;
+
+// Read a tar stream front to back without seeking, streaming members through sfcImageBuilder
+// Returns a description of the problem if the stream is malformed
+std::string readTar(sfcFile& file, bool retain, const sfcTarMemberFunction& member);
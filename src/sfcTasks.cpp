@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "sfcTasks.hpp"
+
+#ifdef __linux__
+    #include <sched.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+#ifndef _WIN32
+    #include <time.h>
+#endif
+
+using namespace std;
+
+unsigned cgroupCpuLimit();
+
+thread_local sfcTaskPool* currentPool = nullptr;
+thread_local size_t currentQueue = 0;
+
+sfcTaskPool::sfcTaskPool(unsigned threads) {
+    if (threads == 0) { threads = availableCores(); }
+    active = threads;
+    for (unsigned i = 0; i <= threads; ++i) {
+        queues.push_back(make_unique<queue>());
+    }
+    for (unsigned i = 0; i < threads; ++i) {
+        this->threads.emplace_back([this, i] { work(i); });
+    }
+}
+
+sfcTaskPool::~sfcTaskPool() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+        wakeup.notify_all();
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+sfcTaskPool* sfcTaskPool::current() {
+    return currentPool;
+}
+
+void sfcTaskPool::spawn(sfcTask&& task) {
+    queue& target = *queues[currentPool == this ? currentQueue : threads.size()];
+    {
+        lock_guard<mutex> guard(target.lock);
+        target.tasks.push_back(std::move(task));
+    }
+    ++queued;
+    lock_guard<mutex> guard(lock);
+    // A waiting thread that isn't active wouldn't take the task
+    if (active < threads.size()) {
+        wakeup.notify_all();
+    } else {
+        wakeup.notify_one();
+    }
+}
+
+void sfcTaskPool::setActive(unsigned count) {
+    lock_guard<mutex> guard(lock);
+    active = clamp(count, 1u, size());
+    wakeup.notify_all();
+}
+
+bool sfcTaskPool::runOne() {
+    sfcTask task;
+    if (!take(task)) { return false; }
+    task();
+    return true;
+}
+
+void sfcTaskPool::idle(const function<bool()>& done) {
+    unique_lock<mutex> guard(lock);
+    wakeup.wait(guard, [&] { return done() || queued > 0 || stopping; });
+}
+
+void sfcTaskPool::wake() {
+    lock_guard<mutex> guard(lock);
+    wakeup.notify_all();
+}
+
+void sfcTaskPool::work(size_t index) {
+    currentPool = this;
+    currentQueue = index;
+    auto allowed = [&] { return index < active || stopping; };
+    while (true) {
+        if (allowed() && runOne()) { continue; }
+        unique_lock<mutex> guard(lock);
+        wakeup.wait(guard, [&] { return (queued > 0 && allowed()) || stopping; });
+        if (stopping && queued == 0) { return; }
+    }
+}
+
+// A worker takes the newest task of its own deque, then the oldest one of another worker or from outside the pool
+bool sfcTaskPool::take(sfcTask& task) {
+    if (queued == 0) { return false; }
+
+    auto takeFrom = [&](size_t index, bool newest) {
+        queue& source = *queues[index];
+        lock_guard<mutex> guard(source.lock);
+        if (source.tasks.empty()) { return false; }
+        if (newest) {
+            task = std::move(source.tasks.back());
+            source.tasks.pop_back();
+        } else {
+            task = std::move(source.tasks.front());
+            source.tasks.pop_front();
+        }
+        --queued;
+        return true;
+    };
+
+    // Work already started in the pool comes before new work from outside
+    bool worker = currentPool == this;
+    if (worker && takeFrom(currentQueue, true)) { return true; }
+    for (size_t i = 1; i <= threads.size(); ++i) {
+        size_t victim = ((worker ? currentQueue : 0) + i) % threads.size();
+        if (takeFrom(victim, false)) { return true; }
+    }
+    return takeFrom(threads.size(), false);
+}
+
+sfcTaskGroup::sfcTaskGroup(sfcTaskPool* pool)
+    : pool(pool) {}
+
+void sfcTaskGroup::run(sfcTask&& task) {
+    if (!pool) {
+        task();
+        return;
+    }
+    ++pending;
+    pool->spawn([this, pool = pool, task = std::move(task)] {
+        task();
+        if (--pending == 0) { pool->wake(); }
+    });
+}
+
+void sfcTaskGroup::wait() {
+    while (pending) {
+        if (!pool->runOne()) { pool->idle([&] { return pending == 0; }); }
+    }
+}
+
+unsigned availableCores() {
+    unsigned cores = max(1u, thread::hardware_concurrency());
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) { cores = max(1, CPU_COUNT(&set)); }
+#endif
+    unsigned limit = cgroupCpuLimit();
+    return limit ? min(cores, limit) : cores;
+}
+
+// CPU quota of the process's cgroup rounded up to whole cores, 0 without one
+unsigned cgroupCpuLimit() {
+#ifdef __linux__
+    // Lines are "id:controllers:path", cgroup v2 has no controllers listed
+    string group, cpuGroup;
+    ifstream membership("/proc/self/cgroup");
+    for (string line; getline(membership, line);) {
+        size_t first = line.find(':'), second = line.find(':', first + 1);
+        if (first == string::npos || second == string::npos) { continue; }
+        string controllers = "," + line.substr(first + 1, second - first - 1) + ",";
+        if (controllers == ",,") { group = line.substr(second + 1); }
+        if (controllers.find(",cpu,") != string::npos) { cpuGroup = line.substr(second + 1); }
+    }
+
+    // cgroup v2 has "quota period" (or "max") in cpu.max
+    for (const string& path : {"/sys/fs/cgroup" + group + "/cpu.max", string("/sys/fs/cgroup/cpu.max")}) {
+        ifstream file(path);
+        string quota;
+        double period = 0;
+        if (file >> quota >> period) {
+            if (quota == "max" || period <= 0) { return 0; }
+            return max(1u, (unsigned)ceil(stod(quota) / period));
+        }
+    }
+
+    // cgroup v1 splits them over two files, with -1 for no quota
+    for (const string& path : {"/sys/fs/cgroup/cpu" + cpuGroup, string("/sys/fs/cgroup/cpu")}) {
+        ifstream quotaFile(path + "/cpu.cfs_quota_us"), periodFile(path + "/cpu.cfs_period_us");
+        double quota = 0, period = 0;
+        if (quotaFile >> quota && periodFile >> period) {
+            if (quota <= 0 || period <= 0) { return 0; }
+            return max(1u, (unsigned)ceil(quota / period));
+        }
+    }
+#endif
+    return 0;
+}
+
+double threadCpuSeconds() {
+#ifndef _WIN32
+    timespec time;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) == 0) { return time.tv_sec + time.tv_nsec * 1e-9; }
+#endif
+    return 0;
+}
+
+bool runInBackground() {
+#ifdef __linux__
+    // Idle I/O class (IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) for this thread (IOPRIO_WHO_PROCESS, 0)
+    bool idleIo = syscall(SYS_ioprio_set, 1, 0, 3 << 13) == 0;
+    sched_param parameters = {};
+    bool idleCpu = sched_setscheduler(0, SCHED_IDLE, &parameters) == 0;
+    return idleIo && idleCpu;
+#else
+    return false;
+#endif
+}
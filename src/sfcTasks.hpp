@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using sfcTask = std::function<void()>;
+
+// Cores the process may run on, within its CPU affinity and cgroup CPU quota
+unsigned availableCores();
+
+// CPU time used by the calling thread in seconds (0 where unknown)
+double threadCpuSeconds();
+
+// Run the calling thread, and threads it starts from then on, only when the CPU and disks are otherwise idle
+// Returns false where that isn't supported
+bool runInBackground();
+
+// Threads running tasks from a deque each: tasks spawned by a task go to its own thread's deque and run newest
+// first, idle threads steal the oldest tasks of busy ones. Tasks from other threads queue up in spawn order.
+struct sfcTaskPool {
+    explicit sfcTaskPool(unsigned threads); // 0 for one per available core
+    ~sfcTaskPool();
+
+    sfcTaskPool(const sfcTaskPool&) = delete;
+    sfcTaskPool& operator=(const sfcTaskPool&) = delete;
+
+    unsigned size() const { return (unsigned)threads.size(); }
+
+    // Only let the first `count` threads take tasks, the others wait (all threads run by default)
+    void setActive(unsigned count);
+    unsigned activeCount() const { return active; }
+
+    void spawn(sfcTask&& task);
+
+    // Run one queued task on the calling thread, false if there was none
+    bool runOne();
+
+    // Sleep until a task is queued or wake() is called, unless done() already holds
+    void idle(const std::function<bool()>& done);
+    void wake();
+
+    // Pool the calling thread is a worker of, if any
+    static sfcTaskPool* current();
+
+  private:
+    struct queue {
+        std::mutex lock;
+        std::deque<sfcTask> tasks;
+    };
+
+    // One deque per thread, plus one for tasks spawned from outside the pool
+    std::vector<std::unique_ptr<queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> queued = 0;
+    std::atomic<unsigned> active = 0;
+    std::mutex lock;
+    std::condition_variable wakeup;
+    bool stopping = false;
+
+    void work(size_t index);
+    bool take(sfcTask& task);
+};
+
+// Tasks that are waited for together, waiting runs queued tasks meanwhile
+// Without a pool tasks run right away on the calling thread
+struct sfcTaskGroup {
+    explicit sfcTaskGroup(sfcTaskPool* pool = sfcTaskPool::current());
+    ~sfcTaskGroup() { wait(); }
+
+    void run(sfcTask&& task);
+    void wait();
+
+  private:
+    sfcTaskPool* pool;
+    std::atomic<size_t> pending = 0;
+};
@@ -0,0 +1,359 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "sfcFile.hpp"
+#include "sfcUring.hpp"
+#include "sfcZip.hpp"
+#include "sfcZstd.hpp"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+    #define SFC_HAVE_URING
+    #include <fcntl.h>
+    #include <linux/io_uring.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+using namespace std;
+
+void loadFilesSync(const vector<string>& paths, const vector<size_t>& order, bool keepCache, const sfcLoadCallbacks& callbacks);
+bool loadable(const string& path, uint64_t size);
+
+// Largest file worth loading: a 12MB image with copier header
+constexpr size_t maxLoadSize = 0xc00000 + 0x200;
+
+// Files loaded at once
+constexpr unsigned loadDepth = 32;
+
+#ifdef SFC_HAVE_URING
+
+// Submission and completion rings of an io_uring set up through the raw system calls
+struct sfcRing {
+    explicit sfcRing(unsigned entries);
+    ~sfcRing();
+
+    bool isOpen() const { return fd >= 0; }
+
+    // Next free submission entry (cleared), or nullptr when all are queued
+    io_uring_sqe* entry(uint64_t tag);
+
+    // Submit queued entries and wait for at least `wait` completions
+    bool submit(unsigned wait);
+
+    // Take the next completion if there is one
+    bool complete(uint64_t& tag, int32_t& result);
+
+  private:
+    int fd = -1;
+    void* rings = MAP_FAILED;
+    size_t ringsSize = 0;
+    io_uring_sqe* entries = nullptr;
+    size_t entriesSize = 0;
+
+    atomic<uint32_t>* sqHead = nullptr;
+    atomic<uint32_t>* sqTail = nullptr;
+    uint32_t sqMask = 0;
+    uint32_t sqCount = 0;
+    uint32_t* sqArray = nullptr;
+    uint32_t queued = 0;
+
+    atomic<uint32_t>* cqHead = nullptr;
+    atomic<uint32_t>* cqTail = nullptr;
+    uint32_t cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+};
+
+sfcRing::sfcRing(unsigned count) {
+    io_uring_params params = {};
+    fd = (int)syscall(__NR_io_uring_setup, count, &params);
+    if (fd < 0) { return; }
+
+    // Opens and statx need 5.6, which also brought single mmap for both rings
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+        close(fd);
+        fd = -1;
+        return;
+    }
+
+    ringsSize = max(params.sq_off.array + params.sq_entries * sizeof(uint32_t), params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    rings = mmap(nullptr, ringsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    entriesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, entriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (rings == MAP_FAILED || sqes == MAP_FAILED) {
+        if (sqes != MAP_FAILED) { munmap(sqes, entriesSize); }
+        close(fd);
+        fd = -1;
+        return;
+    }
+    entries = static_cast<io_uring_sqe*>(sqes);
+
+    auto* base = static_cast<uint8_t*>(rings);
+    sqHead = reinterpret_cast<atomic<uint32_t>*>(base + params.sq_off.head);
+    sqTail = reinterpret_cast<atomic<uint32_t>*>(base + params.sq_off.tail);
+    sqMask = *reinterpret_cast<uint32_t*>(base + params.sq_off.ring_mask);
+    sqCount = params.sq_entries;
+    sqArray = reinterpret_cast<uint32_t*>(base + params.sq_off.array);
+    cqHead = reinterpret_cast<atomic<uint32_t>*>(base + params.cq_off.head);
+    cqTail = reinterpret_cast<atomic<uint32_t>*>(base + params.cq_off.tail);
+    cqMask = *reinterpret_cast<uint32_t*>(base + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+}
+
+sfcRing::~sfcRing() {
+    if (fd < 0) { return; }
+    munmap(entries, entriesSize);
+    munmap(rings, ringsSize);
+    close(fd);
+}
+
+io_uring_sqe* sfcRing::entry(uint64_t tag) {
+    uint32_t tail = sqTail->load(memory_order_relaxed) + queued;
+    if (tail - sqHead->load(memory_order_acquire) >= sqCount) { return nullptr; }
+    uint32_t index = tail & sqMask;
+    io_uring_sqe* sqe = &entries[index];
+    *sqe = {};
+    sqe->user_data = tag;
+    sqArray[index] = index;
+    ++queued;
+    return sqe;
+}
+
+bool sfcRing::submit(unsigned wait) {
+    sqTail->store(sqTail->load(memory_order_relaxed) + queued, memory_order_release);
+    unsigned submitting = queued;
+    queued = 0;
+    while (true) {
+        long result = syscall(__NR_io_uring_enter, fd, submitting, wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        if (result >= 0) { return true; }
+        if (errno != EINTR) { return false; }
+        submitting = 0;
+    }
+}
+
+bool sfcRing::complete(uint64_t& tag, int32_t& result) {
+    uint32_t head = cqHead->load(memory_order_relaxed);
+    if (head == cqTail->load(memory_order_acquire)) { return false; }
+    const io_uring_cqe& cqe = cqes[head & cqMask];
+    tag = cqe.user_data;
+    result = cqe.res;
+    cqHead->store(head + 1, memory_order_release);
+    return true;
+}
+
+bool uringAvailable() {
+    static const bool available = [] {
+        sfcRing ring(1);
+        if (!ring.isOpen()) { return false; }
+        // Opcodes may still be filtered, so try one
+        io_uring_sqe* sqe = ring.entry(0);
+        sqe->opcode = IORING_OP_NOP;
+        uint64_t tag = 0;
+        int32_t result = -1;
+        return ring.submit(1) && ring.complete(tag, result) && result == 0;
+    }();
+    return available;
+}
+
+// Operations on a file in flight, tagged with the file's slot
+enum : uint64_t { opStatx, opOpen, opRead, opClose };
+
+struct sfcLoad {
+    size_t index = 0;
+    const char* path = nullptr;
+    struct statx info = {};
+    int fd = -1;
+    int pending = 0;
+    bool failed = false;
+    sfcBytes bytes;
+    size_t done = 0;
+    vector<uint8_t> cached;
+};
+
+void loadFiles(const vector<string>& paths, const vector<size_t>& order, bool keepCache, const sfcLoadCallbacks& callbacks) {
+    // Declared before the ring so that it is torn down first should reads still be in flight when giving up
+    vector<sfcLoad> slots(loadDepth);
+    // Room for a statx and open for every slot plus a read or close for each completion before the next submit
+    sfcRing ring(loadDepth * 4);
+    if (!uringAvailable() || !ring.isOpen()) {
+        loadFilesSync(paths, order, keepCache, callbacks);
+        return;
+    }
+
+    vector<size_t> freeSlots;
+    for (size_t slot = 0; slot < loadDepth; ++slot) {
+        freeSlots.push_back(loadDepth - 1 - slot);
+    }
+    size_t next = 0;
+    unsigned inFlight = 0;
+
+    auto tag = [](size_t slot, uint64_t op) { return (uint64_t)slot << 2 | op; };
+
+    auto queueRead = [&](size_t slot) {
+        sfcLoad& load = slots[slot];
+        io_uring_sqe* sqe = ring.entry(tag(slot, opRead));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = load.fd;
+        sqe->addr = (uint64_t)(uintptr_t)(load.bytes.data() + load.done);
+        sqe->len = (uint32_t)(load.bytes.size() - load.done);
+        sqe->off = load.done;
+        ++load.pending;
+        ++inFlight;
+    };
+
+    // Hand over the content (if any), close the file without waiting for it and free the slot
+    auto finish = [&](size_t slot) {
+        sfcLoad& load = slots[slot];
+        if (load.fd >= 0) {
+            if (!keepCache && !load.failed) { dropPages(load.fd, load.cached); }
+            io_uring_sqe* sqe = ring.entry(tag(slot, opClose));
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = load.fd;
+            ++inFlight;
+        }
+        if (load.failed) { load.bytes = sfcBytes(); }
+        callbacks.loaded(load.index, std::move(load.bytes));
+        freeSlots.push_back(slot);
+    };
+
+    // Once both statx and open are back, read the whole file with one request
+    auto opened = [&](size_t slot) {
+        sfcLoad& load = slots[slot];
+        if (load.pending) { return; }
+        if (load.fd < 0 || !S_ISREG(load.info.stx_mode) || !loadable(paths[load.index], load.info.stx_size)) {
+            load.failed = true;
+            finish(slot);
+            return;
+        }
+        load.bytes = callbacks.allocate(load.info.stx_size);
+        if (load.bytes.empty()) {
+            load.failed = true;
+            finish(slot);
+            return;
+        }
+        if (!keepCache) { load.cached = residentPages(load.fd, load.info.stx_size); }
+        queueRead(slot);
+    };
+
+    while (next < order.size() || inFlight) {
+        // Start files while there are free slots and room in the batch, but only block on admission when idle
+        while (next < order.size() && !freeSlots.empty() && callbacks.admit(order[next], inFlight == 0)) {
+            size_t slot = freeSlots.back();
+            freeSlots.pop_back();
+            sfcLoad& load = slots[slot];
+            load = sfcLoad();
+            load.index = order[next];
+            load.path = paths[order[next]].c_str();
+            ++next;
+
+            io_uring_sqe* sqe = ring.entry(tag(slot, opStatx));
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uint64_t)(uintptr_t)load.path;
+            sqe->len = STATX_TYPE | STATX_SIZE;
+            sqe->off = (uint64_t)(uintptr_t)&load.info;
+
+            sqe = ring.entry(tag(slot, opOpen));
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uint64_t)(uintptr_t)load.path;
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+
+            load.pending = 2;
+            inFlight += 2;
+        }
+
+        if (!ring.submit(inFlight ? 1 : 0)) {
+            // Files already started are left to the tasks to read, the rest are read one after another
+            vector<bool> busy(loadDepth, true);
+            for (size_t slot : freeSlots) {
+                busy[slot] = false;
+            }
+            for (size_t slot = 0; slot < loadDepth; ++slot) {
+                if (!busy[slot]) { continue; }
+                if (slots[slot].fd >= 0) { close(slots[slot].fd); }
+                callbacks.loaded(slots[slot].index, sfcBytes());
+            }
+            loadFilesSync(paths, vector<size_t>(order.begin() + next, order.end()), keepCache, callbacks);
+            return;
+        }
+
+        uint64_t completion = 0;
+        int32_t result = 0;
+        while (ring.complete(completion, result)) {
+            --inFlight;
+            size_t slot = completion >> 2;
+            sfcLoad& load = slots[slot];
+            switch (completion & 3) {
+            case opStatx:
+                --load.pending;
+                if (result < 0) { load.info.stx_mode = 0; }
+                opened(slot);
+                break;
+            case opOpen:
+                --load.pending;
+                load.fd = result;
+                opened(slot);
+                break;
+            case opRead:
+                --load.pending;
+                if (result > 0) { load.done += (size_t)result; }
+                if (result <= 0) {
+                    load.failed = true;
+                    finish(slot);
+                } else if (load.done < load.bytes.size()) {
+                    queueRead(slot);
+                } else {
+                    finish(slot);
+                }
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+
+#else
+
+bool uringAvailable() {
+    return false;
+}
+
+void loadFiles(const vector<string>& paths, const vector<size_t>& order, bool keepCache, const sfcLoadCallbacks& callbacks) {
+    loadFilesSync(paths, order, keepCache, callbacks);
+}
+
+#endif
+
+// One file after another, still ahead of whoever consumes them
+void loadFilesSync(const vector<string>& paths, const vector<size_t>& order, bool keepCache, const sfcLoadCallbacks& callbacks) {
+    for (size_t index : order) {
+        while (!callbacks.admit(index, true)) {}
+        sfcFile file(paths[index]);
+        size_t size = file.size();
+        sfcBytes bytes;
+        if (loadable(paths[index], size)) { bytes = callbacks.allocate(size); }
+        if (bytes.empty()) {
+            callbacks.loaded(index, sfcBytes());
+            continue;
+        }
+        vector<uint8_t> cached = keepCache ? vector<uint8_t>() : residentPages(file.fd, size);
+        file.advise(sfcFileAdvice::sequential);
+        if (file.readAt(0, bytes.data(), size) != size) { bytes = sfcBytes(); }
+        if (!keepCache) { dropPages(file.fd, cached); }
+        callbacks.loaded(index, std::move(bytes));
+    }
+}
+
+// Archives are left to their own readers, which decompress them from the path
+bool loadable(const string& path, uint64_t size) {
+    return size != 0 && size <= maxLoadSize && !isZipPath(path) && !isZstdPath(path);
+}
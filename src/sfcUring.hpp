@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "sfcImage.hpp"
+
+// Is io_uring usable here (Linux 5.6 or later, and not blocked by seccomp or sysctl)?
+bool uringAvailable();
+
+// How loadFiles hands out work: `admit` is asked before starting each file (only told to wait while nothing is
+// in flight, and asked again should it still turn the file down), `allocate` provides a buffer of the given size (eg. a recycled one, or none to skip reading the file),
+// and `loaded` receives each file's content, or no bytes for anything that isn't a readable regular file of
+// plausible size, is an archive (zip or zstd) or wasn't read
+struct sfcLoadCallbacks {
+    std::function<bool(size_t index, bool wait)> admit;
+    std::function<sfcBytes(size_t size)> allocate;
+    std::function<void(size_t index, sfcBytes&& content)> loaded;
+};
+
+// Load whole regular files in `order` on the calling thread, keeping many opens, statx calls and reads in flight
+// on one io_uring, or one file after another with pread where io_uring isn't available
+// Pages a read brings into the page cache are dropped again once read unless `keepCache` is set
+void loadFiles(
+    const std::vector<std::string>& paths, const std::vector<size_t>& order, bool keepCache, const sfcLoadCallbacks& callbacks
+);
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "sfcBatch.hpp"
+#include "sfcWatch.hpp"
+
+#ifdef __linux__
+    #include <poll.h>
+    #include <sys/inotify.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+using namespace std;
+
+// Files are reported once they've gone this long without being written again
+const chrono::milliseconds settleTime(100);
+
+sfcWatch::~sfcWatch() {
+#ifdef __linux__
+    if (fd >= 0) { ::close(fd); }
+#endif
+}
+
+string sfcWatch::open(const string& directory) {
+#ifdef __linux__
+    error_code ec;
+    if (!filesystem::is_directory(directory, ec)) { return "Cannot watch \"" + directory + "\", not a directory"; }
+    fd = inotify_init1(IN_CLOEXEC);
+    if (fd >= 0) { addTree(directory, false); }
+    if (directories.empty()) { return "Cannot watch \"" + directory + "\""; }
+    return string();
+#else
+    return "Watching directories is only supported on Linux";
+#endif
+}
+
+vector<string> sfcWatch::next() {
+#ifdef __linux__
+    alignas(inotify_event) char buffer[0x10000];
+    while (fd >= 0) {
+        // Files that settled are reported unless they're still as they were when last handled
+        auto now = chrono::steady_clock::now();
+        auto deadline = chrono::steady_clock::time_point::max();
+        vector<string> settled, unsettled;
+        for (const auto& path : written) {
+            auto settles = lastWrite[path] + settleTime;
+            if (settles > now) {
+                deadline = min(deadline, settles);
+                unsettled.push_back(path);
+                continue;
+            }
+            lastWrite.erase(path);
+            stamp state;
+            auto handled = done.find(path);
+            if (current(path, state) && (handled == done.end() || !(handled->second == state))) { settled.push_back(path); }
+        }
+        written = std::move(unsettled);
+        if (!settled.empty()) { return settled; }
+
+        int timeout = written.empty() ? -1 : (int)chrono::ceil<chrono::milliseconds>(deadline - now).count();
+        pollfd readable = {fd, POLLIN, 0};
+        int ready = poll(&readable, 1, timeout);
+        if (ready < 0 && errno != EINTR) { break; }
+        if (ready <= 0) { continue; }
+        ssize_t length = ::read(fd, buffer, sizeof(buffer));
+        if (length < 0 && errno == EINTR) { continue; }
+        if (length <= 0) { break; }
+
+        // Events lost to a queue overflow (with no watch) are skipped, those files are reported when written again
+        for (char* at = buffer; at < buffer + length;) {
+            auto* event = (inotify_event*)at;
+            at += sizeof(inotify_event) + event->len;
+            if (event->mask & IN_IGNORED) {
+                directories.erase(event->wd);
+                continue;
+            }
+            auto directory = directories.find(event->wd);
+            if (directory == directories.end() || event->len == 0) { continue; }
+            string path = (filesystem::path(directory->second) / event->name).string();
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) { addTree(path, true); }
+            } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO) && isImagePath(path)) {
+                write(path);
+            }
+        }
+    }
+#endif
+    return {};
+}
+
+void sfcWatch::handled(const string& path) {
+    stamp state;
+    if (current(path, state)) { done[path] = state; }
+}
+
+void sfcWatch::addTree(const string& directory, bool existing) {
+#ifdef __linux__
+    int wd = inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR | IN_DONT_FOLLOW);
+    if (wd < 0) { return; }
+    directories[wd] = directory;
+
+    // What got into a new directory before it was watched counts as written
+    error_code ec;
+    for (auto it = filesystem::directory_iterator(directory, ec); !ec && it != filesystem::directory_iterator(); it.increment(ec)) {
+        error_code entryError;
+        if (it->is_directory(entryError) && !it->is_symlink(entryError)) {
+            addTree(it->path().string(), existing);
+        } else if (existing && it->is_regular_file(entryError) && isImagePath(it->path().string())) {
+            write(it->path().string());
+        }
+    }
+#endif
+}
+
+void sfcWatch::write(const string& path) {
+    if (lastWrite.find(path) == lastWrite.end()) { written.push_back(path); }
+    lastWrite[path] = chrono::steady_clock::now();
+}
+
+bool sfcWatch::current(const string& path, stamp& state) {
+#ifdef __linux__
+    struct stat info = {};
+    if (::stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) { return false; }
+    state.inode = info.st_ino;
+    state.size = (uint64_t)info.st_size;
+    state.modified = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+    return true;
+#else
+    return false;
+#endif
+}
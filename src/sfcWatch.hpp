@@ -0,0 +1,47 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// ROM image files in a directory tree that were written (closed after writing, or moved in) and then left alone
+// for a moment, so each new or changed image is handled once it's complete, however many writes it took
+// Uses inotify, so only works on Linux
+struct sfcWatch {
+    sfcWatch() = default;
+    ~sfcWatch();
+
+    sfcWatch(const sfcWatch&) = delete;
+    sfcWatch& operator=(const sfcWatch&) = delete;
+
+    // Start watching directory and its subdirectories (including ones created later)
+    // Returns a description of the problem if it can't be watched
+    std::string open(const std::string& directory);
+
+    // Wait for images that were written and have settled since, in the order they were first written
+    // Returns nothing if watching failed
+    std::vector<std::string> next();
+
+    // Take path as it is now as handled, so what was written up to now (eg. fixing it in place) isn't reported
+    void handled(const std::string& path);
+
+  private:
+    struct stamp {
+        uint64_t inode = 0;
+        uint64_t size = 0;
+        int64_t modified = 0;
+        bool operator==(const stamp&) const = default;
+    };
+
+    int fd = -1;
+    std::unordered_map<int, std::string> directories;
+    std::vector<std::string> written;
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> lastWrite;
+    std::unordered_map<std::string, stamp> done;
+
+    void addTree(const std::string& directory, bool existing);
+    void write(const std::string& path);
+    static bool current(const std::string& path, stamp& state);
+};
@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef SFC_HAVE_ZLIB
+    #include <zlib.h>
+#endif
+
+#include "sfcImage.hpp"
+#include "sfcZip.hpp"
+
+using namespace std;
+
+constexpr uint32_t endOfCentralDirectorySignature = 0x06054b50;
+constexpr uint32_t centralDirectorySignature = 0x02014b50;
+constexpr uint32_t localHeaderSignature = 0x04034b50;
+
+constexpr size_t readChunkSize = 0x10000;
+
+struct zipEntry {
+    string name;
+    uint16_t method = 0;
+    uint32_t crc = 0;
+    size_t compressedSize = 0;
+    size_t size = 0;
+    size_t localHeaderOffset = 0;
+};
+
+bool splitZipPath(const string& path, string& archive, string& member);
+vector<zipEntry> readCentralDirectory(ifstream& file, string& error);
+bool readStored(ifstream& file, size_t length, sfcImageBuilder& builder);
+bool readDeflated(ifstream& file, size_t length, sfcImageBuilder& builder, string& error);
+bool hasZipExtension(const string& path);
+uint16_t zipWord(const uint8_t* bytes);
+uint32_t zipLong(const uint8_t* bytes);
+
+bool isZipPath(const string& path) {
+    string archive, member;
+    return splitZipPath(path, archive, member);
+}
+
+sfcImage readZip(const string& path, bool retain, string& error) {
+    string archive, member;
+    if (!splitZipPath(path, archive, member)) { return sfcImage(); }
+
+    ifstream file(archive, ios::binary);
+    if (!file) {
+        error = "Cannot open file \"" + archive + "\"";
+        return sfcImage();
+    }
+
+    vector<zipEntry> entries = readCentralDirectory(file, error);
+    if (!error.empty()) { return sfcImage(); }
+
+    auto entry = find_if(entries.begin(), entries.end(), [&](const zipEntry& e) {
+        if (!member.empty()) { return e.name == member; }
+        size_t size = e.size - ((e.size & 0x3ff) == 0x200 ? 0x200 : 0);
+        return !e.name.ends_with('/') && validImageSize(size);
+    });
+    if (entry == entries.end()) {
+        if (!member.empty()) { error = "No member \"" + member + "\" in zip archive \"" + archive + "\""; }
+        return sfcImage();
+    }
+
+    // Skip local header to get to the member data
+    uint8_t local[30];
+    file.seekg(entry->localHeaderOffset, ios::beg);
+    if (!file.read((char*)local, sizeof(local)) || zipLong(local) != localHeaderSignature) {
+        error = "Zip archive \"" + archive + "\" is corrupt";
+        return sfcImage();
+    }
+    file.seekg(zipWord(&local[26]) + zipWord(&local[28]), ios::cur);
+
+    size_t imageSize = entry->size - ((entry->size & 0x3ff) == 0x200 ? 0x200 : 0);
+    if (!validImageSize(imageSize)) { return sfcImage(); }
+
+    sfcImageBuilder builder(entry->size, retain);
+    bool ok = false;
+    if (entry->method == 0) {
+        ok = readStored(file, entry->compressedSize, builder);
+    } else if (entry->method == 8) {
+        ok = readDeflated(file, entry->compressedSize, builder, error);
+    } else {
+        error = "Zip member \"" + entry->name + "\" uses an unsupported compression method";
+        return sfcImage();
+    }
+
+    if (!ok || !builder.complete()) {
+        if (error.empty()) { error = "Zip member \"" + entry->name + "\" is truncated"; }
+        return sfcImage();
+    }
+    if (builder.crc != entry->crc) {
+        error = "Zip member \"" + entry->name + "\" has a bad CRC32";
+        return sfcImage();
+    }
+    return builder.finish();
+}
+
+// Split "archive.zip/member" into its parts, member is empty if path is the archive itself
+bool splitZipPath(const string& path, string& archive, string& member) {
+    if (hasZipExtension(path) && filesystem::is_regular_file(path)) {
+        archive = path;
+        member = string();
+        return true;
+    }
+    for (size_t slash = path.find('/'); slash != string::npos; slash = path.find('/', slash + 1)) {
+        string prefix = path.substr(0, slash);
+        if (hasZipExtension(prefix) && filesystem::is_regular_file(prefix)) {
+            archive = prefix;
+            member = path.substr(slash + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+vector<zipEntry> readCentralDirectory(ifstream& file, string& error) {
+    vector<zipEntry> entries;
+
+    // End of central directory record is within the last 64KB + 22 bytes (comment may follow it)
+    file.seekg(0, ios::end);
+    size_t fileSize = file.tellg();
+    size_t tailSize = min(fileSize, (size_t)0xffff + 22);
+    vector<uint8_t> tail(tailSize);
+    file.seekg(fileSize - tailSize, ios::beg);
+    file.read((char*)tail.data(), tailSize);
+
+    size_t eocd = string::npos;
+    for (size_t i = tailSize >= 22 ? tailSize - 22 + 1 : 0; i-- > 0;) {
+        if (zipLong(&tail[i]) == endOfCentralDirectorySignature) {
+            eocd = i;
+            break;
+        }
+    }
+    if (eocd == string::npos) {
+        error = "Not a zip archive";
+        return entries;
+    }
+
+    size_t count = zipWord(&tail[eocd + 10]);
+    size_t directorySize = zipLong(&tail[eocd + 12]);
+    size_t directoryOffset = zipLong(&tail[eocd + 16]);
+    if (directoryOffset == 0xffffffff || directoryOffset + directorySize > fileSize) {
+        error = "Zip64 archives are not supported";
+        return entries;
+    }
+
+    vector<uint8_t> directory(directorySize);
+    file.seekg(directoryOffset, ios::beg);
+    file.read((char*)directory.data(), directorySize);
+
+    size_t pos = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (pos + 46 > directory.size() || zipLong(&directory[pos]) != centralDirectorySignature) {
+            error = "Zip central directory is corrupt";
+            return entries;
+        }
+        const uint8_t* record = &directory[pos];
+        size_t nameLength = zipWord(&record[28]);
+        if (pos + 46 + nameLength > directory.size()) {
+            error = "Zip central directory is corrupt";
+            return entries;
+        }
+
+        zipEntry entry;
+        entry.method = zipWord(&record[10]);
+        entry.crc = zipLong(&record[16]);
+        entry.compressedSize = zipLong(&record[20]);
+        entry.size = zipLong(&record[24]);
+        entry.localHeaderOffset = zipLong(&record[42]);
+        entry.name = string((const char*)&record[46], nameLength);
+        entries.push_back(entry);
+
+        pos += 46 + nameLength + zipWord(&record[30]) + zipWord(&record[32]);
+    }
+    return entries;
+}
+
+bool readStored(ifstream& file, size_t length, sfcImageBuilder& builder) {
+    while (length && !builder.complete()) {
+        size_t chunk = min(length, readChunkSize);
+        uint8_t* destination = builder.buffer(chunk);
+        if (!file.read((char*)destination, chunk)) { return false; }
+        builder.commit(chunk);
+        length -= chunk;
+    }
+    return true;
+}
+
+#ifdef SFC_HAVE_ZLIB
+bool readDeflated(ifstream& file, size_t length, sfcImageBuilder& builder, string& error) {
+    z_stream stream = {};
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) { return false; }
+
+    vector<uint8_t> input(readChunkSize);
+    int status = Z_OK;
+    while (status != Z_STREAM_END && !builder.complete()) {
+        if (stream.avail_in == 0 && length > 0) {
+            size_t chunk = min(length, input.size());
+            if (!file.read((char*)input.data(), chunk)) { break; }
+            length -= chunk;
+            stream.next_in = input.data();
+            stream.avail_in = (uInt)chunk;
+        }
+
+        // Inflate straight into the image (or the builder's scratch space)
+        size_t space = readChunkSize;
+        stream.next_out = builder.buffer(space);
+        stream.avail_out = (uInt)space;
+        status = inflate(&stream, Z_NO_FLUSH);
+        if (status == Z_BUF_ERROR) { break; } // Out of input
+        if (status != Z_OK && status != Z_STREAM_END) {
+            error = "Zip member is corrupt";
+            break;
+        }
+        builder.commit(space - stream.avail_out);
+    }
+    inflateEnd(&stream);
+    return error.empty();
+}
+#else
+bool readDeflated(ifstream&, size_t, sfcImageBuilder&, string& error) {
+    error = "Deflated zip members are not supported by this build (zlib not found)";
+    return false;
+}
+#endif
+
+bool hasZipExtension(const string& path) {
+    string ext = filesystem::path(path).extension().string();
+    transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)tolower(c); });
+    return ext == ".zip";
+}
+
+uint16_t zipWord(const uint8_t* bytes) {
+    return (uint16_t)(bytes[0] | (bytes[1] << 8));
+}
+
+uint32_t zipLong(const uint8_t* bytes) {
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+
+#include "sfcImage.hpp"
+
+// True if path is a zip archive, or names a member inside one as "archive.zip/member.sfc"
+bool isZipPath(const std::string& path);
+
+// Decompress a zip member straight into an image in a single pass, checking the stored CRC32
+// Without a member name the first entry with a valid ROM image size is used
+sfcImage readZip(const std::string& path, bool retain, std::string& error);
@@ -0,0 +1,372 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef SFC_HAVE_ZSTD
+    #include <zstd.h>
+#endif
+
+#include "sfcCrc.hpp"
+#include "sfcFile.hpp"
+#include "sfcImage.hpp"
+#include "sfcZstd.hpp"
+
+using namespace std;
+
+bool isZstdPath(const string& path) {
+    string ext = filesystem::path(path).extension().string();
+    transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)tolower(c); });
+    return ext == ".zst";
+}
+
+#ifdef SFC_HAVE_ZSTD
+
+constexpr uint32_t seekTableMagic = 0x184d2a5e;
+constexpr uint32_t indexMagic = 0x184d2a5f;
+constexpr uint32_t seekableFooterMagic = 0x8f92eab1;
+constexpr uint32_t indexVersion = 1;
+
+constexpr size_t frameSize = 0x10000;
+constexpr int compressionLevel = 19;
+
+struct zstdFrame {
+    uint64_t offset = 0;       // Compressed offset in container
+    uint64_t fileOffset = 0;   // Decompressed offset in image file
+    uint32_t compressedSize = 0;
+    uint32_t size = 0;
+};
+
+struct zstdContainer {
+    vector<zstdFrame> frames;
+    uint64_t indexOffset = 0;
+    uint64_t fileSize = 0;
+    uint32_t crc = 0;
+    vector<uint32_t> bankSums;
+};
+
+bool readContainer(sfcFile& file, zstdContainer& container, string& error);
+bool decodeFrame(sfcFile& file, const zstdFrame& frame, vector<uint8_t>& out);
+bool streamFrames(sfcFile& file, uint64_t length, sfcImageBuilder& builder, string& error);
+string compressImage(const string& inputPath, const string& outputPath);
+string decompressImage(const string& inputPath, const string& outputPath);
+bool fileChecksum(const string& path, uint64_t& size, uint32_t& crc);
+static void putLong(vector<uint8_t>& out, uint32_t value);
+static uint32_t getLong(const uint8_t* bytes);
+
+sfcImage readZstd(const string& path, bool retain, bool quick, string& error) {
+    sfcFile file(path);
+    zstdContainer container;
+    if (!file.isOpen()) {
+        error = "Cannot open file \"" + path + "\"";
+        return sfcImage();
+    }
+    if (!readContainer(file, container, error)) { return sfcImage(); }
+
+    size_t headerSize = (container.fileSize & 0x3ff) == 0x200 ? 0x200 : 0;
+    if (!validImageSize(container.fileSize - headerSize)) { return sfcImage(); }
+
+    if (quick && !retain) {
+        // Decode just the frames overlapping copier header and header windows
+        sfcImage image;
+        image.length = container.fileSize - headerSize;
+        image.bankSums = container.bankSums;
+        image.copierHeader.resize(headerSize);
+        for (auto [offset, length] : sfcHeaderWindows) {
+            if (offset < image.length) { image.windows.push_back({offset, vector<uint8_t>(min(length, image.length - offset))}); }
+        }
+
+        vector<uint8_t> decoded;
+        for (const auto& frame : container.frames) {
+            bool isDecoded = false;
+            auto copyOverlap = [&](vector<uint8_t>& bytes, uint64_t fileOffset) {
+                uint64_t begin = max(fileOffset, frame.fileOffset);
+                uint64_t end = min(fileOffset + bytes.size(), frame.fileOffset + frame.size);
+                if (begin >= end) { return true; }
+                if (!isDecoded && !(isDecoded = decodeFrame(file, frame, decoded))) { return false; }
+                copy(&decoded[begin - frame.fileOffset], &decoded[end - frame.fileOffset], &bytes[begin - fileOffset]);
+                return true;
+            };
+
+            bool ok = copyOverlap(image.copierHeader, 0);
+            for (auto& window : image.windows) {
+                ok = ok && copyOverlap(window.bytes, window.offset + headerSize);
+            }
+            if (!ok) {
+                error = "Compressed image \"" + path + "\" is corrupt";
+                return sfcImage();
+            }
+        }
+        return image;
+    }
+
+    sfcImageBuilder builder(container.fileSize, retain);
+    if (!streamFrames(file, container.indexOffset, builder, error)) {
+        if (error.empty()) { error = "Compressed image \"" + path + "\" is corrupt"; }
+        return sfcImage();
+    }
+    if (builder.crc != container.crc) {
+        error = "Compressed image \"" + path + "\" has a bad CRC32";
+        return sfcImage();
+    }
+    return builder.finish();
+}
+
+string convertImage(const string& inputPath, const string& outputPath) {
+    bool compress = isZstdPath(outputPath);
+    if (compress == isZstdPath(inputPath)) { return "Convert between a plain image and a .zst image"; }
+
+    string convertError = compress ? compressImage(inputPath, outputPath) : decompressImage(inputPath, outputPath);
+    if (!convertError.empty()) { return convertError; }
+
+    // Round-trip check: read the written file back and compare it to the source
+    uint64_t plainSize = 0;
+    uint32_t plainCrc = 0;
+    if (!fileChecksum(compress ? inputPath : outputPath, plainSize, plainCrc)) { return "Cannot read back converted image"; }
+
+    sfcFile file(compress ? outputPath : inputPath);
+    zstdContainer container;
+    string error;
+    if (!readContainer(file, container, error)) { return error; }
+
+    sfcImageBuilder builder(container.fileSize, false);
+    if (!streamFrames(file, container.indexOffset, builder, error) || container.fileSize != plainSize ||
+        builder.crc != plainCrc || container.crc != plainCrc) {
+        return "Round-trip check of \"" + outputPath + "\" failed";
+    }
+    return string();
+}
+
+string compressImage(const string& inputPath, const string& outputPath) {
+    sfcFile input(inputPath);
+    uint64_t fileSize = input.size();
+    if (!input.isOpen() || fileSize == 0) { return "Cannot open file \"" + inputPath + "\""; }
+    ofstream output(outputPath, ios::binary | ios::trunc);
+    if (!output) { return "Cannot open file \"" + outputPath + "\" for writing"; }
+
+    size_t headerSize = (fileSize & 0x3ff) == 0x200 ? 0x200 : 0;
+    ZSTD_CCtx* context = ZSTD_createCCtx();
+    vector<uint8_t> chunk(headerSize + frameSize);
+    vector<uint8_t> compressed(ZSTD_compressBound(chunk.size()));
+    vector<uint8_t> seekTable;
+    vector<uint32_t> bankSums((fileSize - headerSize + sfcBankSize - 1) / sfcBankSize, 0);
+    uint32_t crc = 0;
+    uint32_t frameCount = 0;
+
+    // Frames are aligned to image banks, the first one also holds the copier header
+    uint64_t offset = 0;
+    while (offset < fileSize) {
+        size_t length = (size_t)min<uint64_t>(offset == 0 ? headerSize + frameSize : frameSize, fileSize - offset);
+        if (input.read(chunk.data(), length) != length) {
+            ZSTD_freeCCtx(context);
+            return "Cannot read file \"" + inputPath + "\"";
+        }
+
+        crc = crc32(chunk.data(), length, crc);
+        for (size_t i = 0; i < length; ++i) {
+            if (offset + i >= headerSize) { bankSums[(offset + i - headerSize) / sfcBankSize] += chunk[i]; }
+        }
+
+        size_t compressedSize = ZSTD_compressCCtx(context, compressed.data(), compressed.size(), chunk.data(), length, compressionLevel);
+        if (ZSTD_isError(compressedSize)) {
+            ZSTD_freeCCtx(context);
+            return "Cannot compress file \"" + inputPath + "\"";
+        }
+        output.write((const char*)compressed.data(), compressedSize);
+        putLong(seekTable, (uint32_t)compressedSize);
+        putLong(seekTable, (uint32_t)length);
+        ++frameCount;
+        offset += length;
+    }
+    ZSTD_freeCCtx(context);
+
+    // Index of file size, CRC32 and bank sums
+    vector<uint8_t> index;
+    putLong(index, indexMagic);
+    putLong(index, (uint32_t)(20 + bankSums.size() * 4));
+    index.insert(index.end(), {'S', 'F', 'C', 'I'});
+    putLong(index, indexVersion);
+    putLong(index, (uint32_t)fileSize);
+    putLong(index, (uint32_t)(fileSize >> 32));
+    putLong(index, crc);
+    for (uint32_t sum : bankSums) {
+        putLong(index, sum);
+    }
+    output.write((const char*)index.data(), index.size());
+
+    // Seek table in zstd seekable format, without per-frame checksums
+    vector<uint8_t> table;
+    putLong(table, seekTableMagic);
+    putLong(table, (uint32_t)(seekTable.size() + 9));
+    table.insert(table.end(), seekTable.begin(), seekTable.end());
+    putLong(table, frameCount);
+    table.push_back(0);
+    putLong(table, seekableFooterMagic);
+    output.write((const char*)table.data(), table.size());
+
+    if (!output.good()) { return "Cannot write file \"" + outputPath + "\""; }
+    return string();
+}
+
+string decompressImage(const string& inputPath, const string& outputPath) {
+    sfcFile input(inputPath);
+    zstdContainer container;
+    string error;
+    if (!input.isOpen()) { return "Cannot open file \"" + inputPath + "\""; }
+    if (!readContainer(input, container, error)) { return error; }
+
+    ofstream output(outputPath, ios::binary | ios::trunc);
+    if (!output) { return "Cannot open file \"" + outputPath + "\" for writing"; }
+
+    vector<uint8_t> decoded;
+    for (const auto& frame : container.frames) {
+        if (!decodeFrame(input, frame, decoded)) { return "Compressed image \"" + inputPath + "\" is corrupt"; }
+        output.write((const char*)decoded.data(), decoded.size());
+    }
+    if (!output.good()) { return "Cannot write file \"" + outputPath + "\""; }
+    return string();
+}
+
+// Parse seek table and index at the end of the container
+bool readContainer(sfcFile& file, zstdContainer& container, string& error) {
+    uint64_t containerSize = file.size();
+    uint8_t footer[9];
+    if (containerSize < 9 || file.readAt(containerSize - 9, footer, 9) != 9 || getLong(&footer[5]) != seekableFooterMagic) {
+        error = "Not a seekable zstd image";
+        return false;
+    }
+
+    uint32_t frameCount = getLong(&footer[0]);
+    size_t entrySize = (footer[4] & 0x80) ? 12 : 8;
+    uint64_t tableSize = 8 + (uint64_t)frameCount * entrySize + 9;
+    if (tableSize > containerSize) {
+        error = "Seek table of zstd image is corrupt";
+        return false;
+    }
+    vector<uint8_t> table(tableSize);
+    if (file.readAt(containerSize - tableSize, table.data(), tableSize) != tableSize || getLong(&table[0]) != seekTableMagic ||
+        getLong(&table[4]) != tableSize - 8) {
+        error = "Seek table of zstd image is corrupt";
+        return false;
+    }
+
+    uint64_t offset = 0, fileOffset = 0;
+    for (uint32_t i = 0; i < frameCount; ++i) {
+        const uint8_t* entry = &table[8 + i * entrySize];
+        zstdFrame frame = {offset, fileOffset, getLong(&entry[0]), getLong(&entry[4])};
+        container.frames.push_back(frame);
+        offset += frame.compressedSize;
+        fileOffset += frame.size;
+    }
+    container.indexOffset = offset;
+
+    uint8_t indexHeader[28];
+    if (offset + sizeof(indexHeader) > containerSize - tableSize || file.readAt(offset, indexHeader, sizeof(indexHeader)) != sizeof(indexHeader) || getLong(&indexHeader[0]) != indexMagic ||
+        !equal(&indexHeader[8], &indexHeader[12], "SFCI") || getLong(&indexHeader[12]) != indexVersion) {
+        error = "Index of zstd image is missing";
+        return false;
+    }
+    container.fileSize = getLong(&indexHeader[16]) | ((uint64_t)getLong(&indexHeader[20]) << 32);
+    container.crc = getLong(&indexHeader[24]);
+
+    // There's a sum for every bank of the image (without copier header), and they have to fit before the seek table
+    uint32_t indexSize = getLong(&indexHeader[4]);
+    uint64_t headerSize = (container.fileSize & 0x3ff) == 0x200 ? 0x200 : 0;
+    uint64_t bankCount = (indexSize - 20) / 4;
+    if (indexSize < 20 || indexSize % 4 != 0 || container.fileSize != fileOffset ||
+        bankCount != (container.fileSize - headerSize + sfcBankSize - 1) / sfcBankSize ||
+        offset + sizeof(indexHeader) + bankCount * 4 > containerSize - tableSize) {
+        error = "Index of zstd image is corrupt";
+        return false;
+    }
+    vector<uint8_t> sums(bankCount * 4);
+    if (file.readAt(offset + sizeof(indexHeader), sums.data(), sums.size()) != sums.size()) {
+        error = "Index of zstd image is corrupt";
+        return false;
+    }
+    for (size_t i = 0; i < bankCount; ++i) {
+        container.bankSums.push_back(getLong(&sums[i * 4]));
+    }
+    return true;
+}
+
+bool decodeFrame(sfcFile& file, const zstdFrame& frame, vector<uint8_t>& out) {
+    vector<uint8_t> compressed(frame.compressedSize);
+    if (file.readAt(frame.offset, compressed.data(), compressed.size()) != compressed.size()) { return false; }
+    out.resize(frame.size);
+    size_t result = ZSTD_decompress(out.data(), out.size(), compressed.data(), compressed.size());
+    return !ZSTD_isError(result) && result == frame.size;
+}
+
+// Decompress the data frames front to back straight into the builder
+bool streamFrames(sfcFile& file, uint64_t length, sfcImageBuilder& builder, string& error) {
+    ZSTD_DStream* stream = ZSTD_createDStream();
+    vector<uint8_t> input(ZSTD_DStreamInSize());
+    ZSTD_inBuffer in = {input.data(), 0, 0};
+    uint64_t offset = 0;
+    bool ok = true;
+
+    while (!builder.complete()) {
+        if (in.pos == in.size) {
+            size_t chunk = (size_t)min<uint64_t>(input.size(), length - offset);
+            if (chunk == 0 || file.readAt(offset, input.data(), chunk) != chunk) {
+                ok = false;
+                break;
+            }
+            offset += chunk;
+            in = {input.data(), chunk, 0};
+        }
+
+        size_t space = ZSTD_DStreamOutSize();
+        ZSTD_outBuffer out = {builder.buffer(space), space, 0};
+        size_t result = ZSTD_decompressStream(stream, &out, &in);
+        if (ZSTD_isError(result)) {
+            error = ZSTD_getErrorName(result);
+            ok = false;
+            break;
+        }
+        builder.commit(out.pos);
+    }
+    ZSTD_freeDStream(stream);
+    return ok;
+}
+
+bool fileChecksum(const string& path, uint64_t& size, uint32_t& crc) {
+    sfcFile file(path);
+    if (!file.isOpen()) { return false; }
+    vector<uint8_t> buffer(0x100000);
+    size = 0;
+    crc = 0;
+    while (size_t length = file.read(buffer.data(), buffer.size())) {
+        crc = crc32(buffer.data(), length, crc);
+        size += length;
+    }
+    return true;
+}
+
+// Little endian long
+static void putLong(vector<uint8_t>& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back((uint8_t)(value >> (i * 8)));
+    }
+}
+
+static uint32_t getLong(const uint8_t* bytes) {
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+#else
+
+sfcImage readZstd(const string&, bool, bool, string& error) {
+    error = "Compressed images are not supported by this build (zstd not found)";
+    return sfcImage();
+}
+
+string convertImage(const string&, const string&) {
+    return "Compressed images are not supported by this build (zstd not found)";
+}
+
+#endif
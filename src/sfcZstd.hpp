@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+
+#include "sfcImage.hpp"
+
+// Seekable zstd image container (".zst")
+//
+// The file is compressed as independent zstd frames of 64KB of image data each, followed by an
+// index with the file CRC32 and per-bank sums, and a seek table in the zstd seekable format.
+// Any zstd decompressor can unpack it, and header windows can be decoded on their own.
+
+bool isZstdPath(const std::string& path);
+
+// Read a seekable zstd image by streaming through all frames, checking the stored CRC32
+// Quick reading only decodes the frames holding header windows and takes bank sums from the index
+sfcImage readZstd(const std::string& path, bool retain, bool quick, std::string& error);
+
+// Convert a plain image to the seekable zstd container, or back, depending on output extension
+// The output is read back and compared against the input; returns a description of any problem
+std::string convertImage(const std::string& inputPath, const std::string& outputPath);
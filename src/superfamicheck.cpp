@@ -1,9 +1,22 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <ezOptionParser/ezOptionParser.hpp>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <string>
 
+#include "sfcBatch.hpp"
+#include "sfcFile.hpp"
+#include "sfcReader.hpp"
+#include "sfcResult.hpp"
 #include "sfcRom.hpp"
+#include "sfcServe.hpp"
+#include "sfcTar.hpp"
+#include "sfcWatch.hpp"
+#include "sfcZip.hpp"
+#include "sfcZstd.hpp"
 
 using namespace std;
 
@@ -15,7 +28,10 @@ bool fileAvailable(const std::string& path) {
 int main(int argc, const char* argv[]) {
     ez::ezOptionParser opt;
     opt.overview = "SuperFamicheck 1.1.0";
-    opt.syntax = "superfamicheck rom_file [options...]";
+    opt.syntax = "superfamicheck rom_file [options...]  (- reads rom_file from stdin)\n"
+                 "       superfamicheck merge result_file... [options...]  (combine batch results)\n"
+                 "       superfamicheck --watch directory [options...]  (check images as they are written)\n"
+                 "       superfamicheck --serve socket [options...]  (check images on request)";
 
     opt.add(
         "",    // Default
@@ -33,6 +49,150 @@ int main(int argc, const char* argv[]) {
         "Output ROM image path", "-o", "--out"
     );
 
+    opt.add(
+        "",    // Default
+        false, // Required
+        1,     // Number of args expected
+        0,     // Delimiter if expecting multiple args
+        "Apply IPS/BPS patch in memory before checking", "-p", "--patch"
+    );
+
+    opt.add(
+        "",    // Default
+        false, // Required
+        1,     // Number of args expected
+        0,     // Delimiter if expecting multiple args
+        "Check every ROM image in tar archive (- for stdin)", "-t", "--tar"
+    );
+
+    opt.add(
+        "",    // Default
+        false, // Required
+        1,     // Number of args expected
+        0,     // Delimiter if expecting multiple args
+        "Convert to/from seekable zstd image (.zst) and verify round-trip", "-c", "--convert"
+    );
+
+    opt.add(
+        "",    // Default
+        false, // Required
+        0,     // Number of args expected
+        0,     // Delimiter if expecting multiple args
+        "Use stored bank sums of .zst images instead of decompressing", "-q", "--quick"
+    );
+
+    opt.add(
+        "",    // Default
+        false, // Required
+        0,     // Number of args expected
+        0,     // Delimiter if expecting multiple args
+        "Read split copier files as one image (parts in order, or found from the first)", "-m", "--multipart"
+    );
+
+    opt.add(
+        "",    // Default
+        false, // Required
+        0,     // Number of args expected
+        0,     // Delimiter if expecting multiple args
+        "Check every ROM image given (directories are searched recursively)", "-b", "--batch"
+    );
+
+    opt.add(
+        "1",   // Default
+        false, // Required
+        1,     // Number of args expected
+        0,     // Delimiter if expecting multiple args
+        "Number of images checked in parallel in batch mode (0 for one per core, auto to adapt)", "-j", "--jobs"
+    );
+
+    opt.add(
+        "",    // Default
+        false, // Required
+        0,     // Number of args expected
+        0,     // Delimiter if expecting multiple args
+        "Keep files in the page cache after reading (dropped otherwise)", "-k", "--keep-cache"
+    );
+
+    opt.add(
+        "0",   // Default
+        false, // Required
+        1,     // Number of args expected
+        0,     // Delimiter if expecting multiple args
+        "Memory for images in flight in batch mode in MB, larger images are streamed (0 for no limit)", "-M", "--max-memory"
+    );
+
+    opt.add(
+        "0",   // Default
+        false, // Required
+        1,     // Number of args expected
+        0,     // Delimiter if expecting multiple args
+        "Read at most this many MB per second on average in batch mode (0 for no limit)", "--io-limit"
+    );
+
+    opt.add(
+        "",    // Default
+        false, // Required
+        0,     // Number of args expected
+        0,     // Delimiter if expecting multiple args
+        "Only use the CPU and disks when they're otherwise idle (idle I/O priority and SCHED_IDLE)", "--background"
+    );
+
+    opt.add(
+        "",    // Default
+        false, // Required
+        1,     // Number of args expected
+        0,     // Delimiter if expecting multiple args
+        "Only check shard i of N (from 1) in batch mode, split by a hash of each image's relative path", "--shard"
+    );
+
+    opt.add(
+        "",    // Default
+        false, // Required
+        1,     // Number of args expected
+        0,     // Delimiter if expecting multiple args
+        "Write batch or merge results to file (.ndjson/.jsonl/.json as NDJSON, otherwise binary)", "-r", "--results"
+    );
+
+    opt.add(
+        "",    // Default
+        false, // Required
+        1,     // Number of args expected
+        0,     // Delimiter if expecting multiple args
+        "Keep results of a batch run in checkpoint file as images are done", "--checkpoint"
+    );
+
+    opt.add(
+        "",    // Default
+        false, // Required
+        0,     // Number of args expected
+        0,     // Delimiter if expecting multiple args
+        "Resume an interrupted batch run from its checkpoint, skipping images already done", "--resume"
+    );
+
+    opt.add(
+        "",    // Default
+        false, // Required
+        1,     // Number of args expected
+        0,     // Delimiter if expecting multiple args
+        "Check ROM images written to directory as they are completed, streaming NDJSON results to stdout", "-w", "--watch"
+    );
+
+    opt.add(
+        "",    // Default
+        false, // Required
+        1,     // Number of args expected
+        0,     // Delimiter if expecting multiple args
+        "Answer check requests on a Unix domain socket (lines of \"json PATH\" or \"binary PATH\")", "--serve"
+    );
+
+    opt.add(
+        "",    // Default
+        false, // Required
+        1,     // Number of args expected
+        0,     // Delimiter if expecting multiple args
+        "Also publish results to a shared memory ring for local readers (POSIX shm name, eg. /superfamicheck)", "--ring"
+    );
+
     opt.add(
         "",    // Default
         false, // Required
@@ -94,10 +254,295 @@ int main(int argc, const char* argv[]) {
         return 1;
     }
 
+    if (opt.isSet("-t")) {
+        string tarPath;
+        opt.get("-t")->getString(tarPath);
+        if (opt.isSet("-f") || opt.isSet("-p")) {
+            cerr << "Images in tar archives can only be checked" << '\n';
+            return 1;
+        }
+
+        sfcFile file(tarPath);
+        if (!file.isOpen()) {
+            cerr << "Cannot open file \"" << tarPath << "\"" << '\n';
+            return 1;
+        }
+
+        // Members are reported as they stream past, nothing is kept but the header windows
+        string tarError = readTar(file, false, [&](const string& name, sfcImage&& image) {
+            sfcRom rom(tarPath == "-" ? name : tarPath + "/" + name, std::move(image));
+            if (!verysilent) { cout << rom.description(silent); }
+        });
+        if (!tarError.empty()) {
+            cerr << tarError << '\n';
+            return 1;
+        }
+        return 0;
+    }
+
+    vector<string> arguments;
+    for (size_t i = 1; i < opt.firstArgs.size(); ++i) {
+        arguments.push_back(*opt.firstArgs[i]);
+    }
+    for (auto* arg : opt.lastArgs) {
+        arguments.push_back(*arg);
+    }
+    if (opt.isSet("-b") && arguments.empty()) {
+        cerr << "Missing required argument: rom_file"
+             << "\n\n";
+        std::cout << usage;
+        return 1;
+    }
+
+    // Result records go to a file (or stdout, moving reports to stderr), watch mode streams NDJSON to stdout by default
+    bool watching = opt.isSet("-w");
+    string resultsPath = watching ? "-" : "";
+    if (opt.isSet("-r")) { opt.get("-r")->getString(resultsPath); }
+    sfcResultFormat resultsFormat = watching && resultsPath == "-" ? sfcResultFormat::ndjson : resultFormat(resultsPath);
+    sfcFile resultsFile;
+    if (!resultsPath.empty()) {
+        if (!opt.isSet("-b") && !watching && (arguments.empty() || arguments.front() != "merge")) {
+            cerr << "Results can only be written in batch or watch mode or when merging" << '\n';
+            return 1;
+        }
+        resultsFile = sfcFile(resultsPath, sfcFileMode::create);
+        string header = resultsHeader(resultsFormat);
+        if (!resultsFile.isOpen() || !resultsFile.write((const uint8_t*)header.data(), header.size())) {
+            cerr << "Cannot open file \"" << resultsPath << "\" for writing" << '\n';
+            return 1;
+        }
+    }
+    ostream& resultsReport = resultsPath == "-" ? cerr : cout;
+    auto writeResult = [&](const sfcResult& result) {
+        if (!verysilent) { resultsReport << result.report; }
+        if (resultsFile.isOpen()) {
+            string record = encodeResult(result, resultsFormat);
+            resultsFile.write((const uint8_t*)record.data(), record.size());
+        }
+    };
+
+    // Results of separate (eg. sharded) batch runs, reported in order of image name
+    if (!arguments.empty() && arguments.front() == "merge" && !opt.isSet("-b") && !fileAvailable("merge")) {
+        if (arguments.size() < 2) {
+            cerr << "Missing result files to merge" << '\n';
+            return 1;
+        }
+        vector<sfcResult> merged;
+        for (size_t i = 1; i < arguments.size(); ++i) {
+            string error = readResults(arguments[i], merged);
+            if (!error.empty()) {
+                cerr << error << '\n';
+                return 1;
+            }
+        }
+        stable_sort(merged.begin(), merged.end(), [](const sfcResult& a, const sfcResult& b) { return a.name < b.name; });
+        for (size_t i = 0; i < merged.size(); ++i) {
+            if (i > 0 && merged[i].name == merged[i - 1].name) {
+                cerr << "Skipped duplicate result for \"" << merged[i].name << "\"" << '\n';
+                continue;
+            }
+            writeResult(merged[i]);
+        }
+        return 0;
+    }
+
+    bool serving = opt.isSet("--serve");
+    if (opt.isSet("--ring") && !opt.isSet("-b") && !watching && !serving) {
+        cerr << "Results can only be published to a ring in batch, watch or server mode" << '\n';
+        return 1;
+    }
+    if (opt.isSet("-b") || watching || serving) {
+        if (opt.isSet("-o") || opt.isSet("-p") || opt.isSet("-c") || opt.isSet("-m")) {
+            cerr << "Batch, watch and server modes can only check and fix images in place" << '\n';
+            return 1;
+        }
+        if ((int)opt.isSet("-b") + watching + serving > 1 || ((watching || serving) && (opt.isSet("--checkpoint") || opt.isSet("--shard")))) {
+            cerr << "Batch, watch and server modes can't be combined, and only batch mode takes checkpoints or shards" << '\n';
+            return 1;
+        }
+        if (serving && opt.isSet("-f")) {
+            cerr << "Server mode only checks images" << '\n';
+            return 1;
+        }
+
+        unsigned shard = 0, shardCount = 1;
+        if (opt.isSet("--shard")) {
+            string shardArgument;
+            opt.get("--shard")->getString(shardArgument);
+            if (sscanf(shardArgument.c_str(), "%u/%u", &shard, &shardCount) != 2 || shard < 1 || shard > shardCount) {
+                cerr << "Invalid shard \"" << shardArgument << "\", expected i/N with i from 1 to N" << '\n';
+                return 1;
+            }
+            --shard;
+        }
+        // "auto" starts at one job per core and adapts, with up to four times as many threads for slow storage
+        string jobsArgument;
+        opt.get("-j")->getString(jobsArgument);
+        bool adaptive = jobsArgument == "auto";
+        int jobs = adaptive ? (int)min(availableCores() * 4, 64u) : atoi(jobsArgument.c_str());
+        sfcBatchOptions batchOptions;
+        batchOptions.keepCache = opt.isSet("-k");
+        batchOptions.adaptive = adaptive;
+        int maxMemory = 0;
+        opt.get("-M")->getInt(maxMemory);
+        batchOptions.maxMemory = (size_t)max(maxMemory, 0) << 20;
+        double ioLimit = 0;
+        opt.get("--io-limit")->getDouble(ioLimit);
+        batchOptions.ioLimit = max(ioLimit, 0.0) * 0x100000;
+
+        // Threads started from here on (pool and loader) inherit the priority
+        if (opt.isSet("--background") && !runInBackground()) {
+            cerr << "Cannot lower priority for background operation" << '\n';
+        }
+
+        sfcReadOptions readOptions;
+        readOptions.retainImage = opt.isSet("-f");
+        readOptions.keepCache = opt.isSet("-k");
+        bool fix = opt.isSet("-f");
+
+        sfcCheckpoint checkpoint;
+        if (opt.isSet("--checkpoint")) {
+            string checkpointPath;
+            opt.get("--checkpoint")->getString(checkpointPath);
+            string checkpointError = checkpoint.open(checkpointPath, opt.isSet("--resume"));
+            if (!checkpointError.empty()) {
+                cerr << checkpointError << '\n';
+                return 1;
+            }
+        } else if (opt.isSet("--resume")) {
+            cerr << "Resuming requires a checkpoint file (--checkpoint)" << '\n';
+            return 1;
+        }
+
+        sfcRingWriter ring;
+        if (opt.isSet("--ring")) {
+            string ringName;
+            opt.get("--ring")->getString(ringName);
+            string ringError = ring.open(ringName);
+            if (!ringError.empty()) {
+                cerr << ringError << '\n';
+                return 1;
+            }
+        }
+
+        sfcTaskPool pool((unsigned)max(jobs, 0));
+        auto checkImage = [&](const string& path, sfcBytes&& content, bool stream) {
+            sfcReadOptions options = readOptions;
+            if (stream) { options.retainImage = false; }
+            sfcRom rom = content.empty() ? sfcRom(path, options) : sfcRom(path, readBytes(std::move(content), options.retainImage));
+            string result = rom.description(silent);
+            if (rom.isValid && fix && stream && rom.fixNeedsImage(path)) {
+                // Read again in full for fixes that rewrite the whole file
+                rom = sfcRom(path, readOptions);
+            }
+            if (rom.isValid && fix) {
+                result += rom.fix(path, silent);
+            }
+            ring.publish(makeRingRecord(path, rom));
+            return makeResult(path, rom, result);
+        };
+
+        // Requests are checked on the pool's threads, each reusing its read buffer
+        if (serving) {
+            string socketPath;
+            opt.get("--serve")->getString(socketPath);
+            string serveError = serve(socketPath, pool, [&](const string& name, sfcRom& rom) {
+                ring.publish(makeRingRecord(name, rom));
+                return makeResult(name, rom, verysilent ? string() : rom.description(silent));
+            });
+            cerr << serveError << '\n';
+            return 1;
+        }
+
+        // Images written to the directory are checked in bursts, once every file in the burst is complete
+        if (watching) {
+            string watchPath;
+            opt.get("-w")->getString(watchPath);
+            sfcWatch watch;
+            string watchError = watch.open(watchPath);
+            if (!watchError.empty()) {
+                cerr << watchError << '\n';
+                return 1;
+            }
+            for (vector<string> written; !(written = watch.next()).empty();) {
+                runBatch(written, pool, batchOptions, checkImage, [&](const sfcResult& result) {
+                    // Fixing in place is a write of its own, which isn't checked again
+                    watch.handled(result.name);
+                    sfcResult named = result;
+                    named.name = filesystem::path(result.name).lexically_relative(watchPath).generic_string();
+                    writeResult(named);
+                });
+                resultsReport.flush();
+            }
+            cerr << "Stopped watching \"" << watchPath << "\"" << '\n';
+            return 1;
+        }
+
+        vector<string> names, images;
+        {
+            vector<string> allNames, allImages = findImages(arguments, &pool, &allNames);
+            if (allImages.empty()) {
+                cerr << "No ROM images found" << '\n';
+                return 1;
+            }
+            for (size_t i = 0; i < allImages.size(); ++i) {
+                if (!inShard(allNames[i], shard, shardCount)) { continue; }
+                images.push_back(allImages[i]);
+                names.push_back(allNames[i]);
+            }
+        }
+
+        // Images done before resuming are reported from the checkpoint in their place among the others
+        vector<string> remaining;
+        for (const auto& image : images) {
+            if (!checkpoint.find(image)) { remaining.push_back(image); }
+        }
+        size_t next = 0;
+        auto reportDone = [&] {
+            for (const sfcResult* done; next < images.size() && (done = checkpoint.find(images[next])); ++next) {
+                sfcResult named = *done;
+                named.name = names[next];
+                writeResult(named);
+            }
+        };
+
+        // Results arrive in the order of images
+        runBatch(
+            remaining, pool, batchOptions,
+            [&](const string& path, sfcBytes&& content, bool stream) {
+                sfcResult done = checkImage(path, std::move(content), stream);
+                checkpoint.add(done);
+                return done;
+            },
+            [&](const sfcResult& result) {
+                reportDone();
+                sfcResult named = result;
+                named.name = names[next++];
+                writeResult(named);
+            }
+        );
+        reportDone();
+        checkpoint.flush();
+        return 0;
+    }
+
     string inputPath = string();
+    vector<string> parts;
+    if (opt.isSet("-m")) {
+        parts = arguments;
+        if (parts.size() == 1) { parts = findParts(parts.front()); }
+        for (const auto& part : parts) {
+            if (!fileAvailable(part)) {
+                cerr << "Cannot open file \"" << part << "\"" << '\n';
+                return 1;
+            }
+        }
+    }
+
     if (opt.firstArgs.size() > 1 || opt.lastArgs.size() > 0) {
         inputPath = opt.firstArgs.size() > 1 ? *opt.firstArgs.back() : *opt.lastArgs.front();
-        if (!fileAvailable(inputPath)) {
+        if (!parts.empty()) { inputPath = parts.front(); }
+        if (inputPath != "-" && !fileAvailable(inputPath) && !isZipPath(inputPath)) {
             cerr << "Cannot open file \"" << inputPath << "\"" << '\n';
             return 1;
         }
@@ -108,17 +553,60 @@ int main(int argc, const char* argv[]) {
         return 1;
     }
 
-    sfcRom rom(inputPath);
+    if (opt.isSet("-c")) {
+        string convertPath;
+        opt.get("-c")->getString(convertPath);
+        string convertError = convertImage(inputPath, convertPath);
+        if (!convertError.empty()) {
+            cerr << convertError << '\n';
+            return 1;
+        }
+        if (!silent && !verysilent) { cout << "Converted \"" << inputPath << "\" to \"" << convertPath << "\" (round-trip verified)" << '\n'; }
+        return 0;
+    }
 
-    if (!verysilent) { cout << rom.description(silent); }
+    sfcReadOptions readOptions;
+    readOptions.retainImage = opt.isSet("-f");
+    readOptions.quick = opt.isSet("-q");
+    readOptions.keepCache = opt.isSet("-k");
 
-    if (rom.isValid && opt.isSet("-f")) {
-        string outputPath = inputPath;
-        if (opt.isSet("-o")) { opt.get("-o")->getString(outputPath); }
+    if (opt.isSet("-p")) {
+        opt.get("-p")->getString(readOptions.patchPath);
+        if (!fileAvailable(readOptions.patchPath)) {
+            cerr << "Cannot open file \"" << readOptions.patchPath << "\"" << '\n';
+            return 1;
+        }
+        if (opt.isSet("-f") && !opt.isSet("-o")) {
+            cerr << "Fixing a patched image requires an output path (-o)" << '\n';
+            return 1;
+        }
+    }
+
+    if ((isZipPath(inputPath) || isZstdPath(inputPath) || parts.size() > 1) && opt.isSet("-f") && !opt.isSet("-o")) {
+        cerr << "Fixing an image in an archive requires an output path (-o)" << '\n';
+        return 1;
+    }
+
+    string outputPath = inputPath;
+    if (opt.isSet("-o")) { opt.get("-o")->getString(outputPath); }
 
+    // When the image goes to stdout, reports go to stderr
+    bool pipeOutput = opt.isSet("-f") && outputPath == "-";
+    ostream& report = pipeOutput ? cerr : cout;
+
+    sfcRom rom = parts.size() > 1 ? sfcRom(parts, readOptions) : sfcRom(inputPath, readOptions);
+
+    if (!verysilent) { report << rom.description(silent); }
+
+    if (rom.isValid && opt.isSet("-f")) {
         string fixDescripton = rom.fix(outputPath, silent);
-        if (!verysilent) { cout << fixDescripton; }
+        if (!verysilent) { report << fixDescripton; }
     }
 
+    // Nothing fixed was written (eg. to a pipeline's next stage) when the image is invalid or writing failed
+    if (opt.isSet("-f") && (!rom.isValid || !rom.error.empty())) {
+        if (verysilent && !rom.error.empty()) { cerr << rom.error << '\n'; }
+        return 1;
+    }
     return 0;
 }
@@ -1,8 +1,33 @@
+#include "../src/sfcBatch.hpp"
+#include "../src/sfcCrc.hpp"
+#include "../src/sfcPatch.hpp"
+#include "../src/sfcReader.hpp"
+#include "../src/sfcResult.hpp"
+#include "../src/sfcRing.hpp"
 #include "../src/sfcRom.hpp"
+#include "../src/sfcServe.hpp"
+#include "../src/sfcTasks.hpp"
+#include "../src/sfcWatch.hpp"
+#include "../src/sfcZstd.hpp"
 #include <catch2/catch_test_macros.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+#endif
 
 //
 // Simple test ROMs
@@ -172,3 +197,552 @@ TEST_CASE("sfcRom.hasCorrectChecksum") {
     REQUIRE(rom_hasCorrectChecksum(rom_spl4, true) == true);
     REQUIRE(rom_hasCorrectChecksum(rom_tmz, true) == true);
 }
+
+TEST_CASE("sfcPatch") {
+    const std::vector<uint8_t> check = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+    REQUIRE(crc32(check.data(), check.size()) == 0xcbf43926);
+    const std::vector<uint8_t> zeros(12345);
+    REQUIRE(crc32Zeros(zeros.size(), 0xcbf43926) == crc32(zeros.data(), zeros.size(), 0xcbf43926));
+
+    const std::vector<uint8_t> source = {0, 1, 2, 3, 4, 5, 6, 7};
+    const std::vector<uint8_t> target = {0, 1, 9, 9, 4, 5, 6, 9};
+    auto records = diffRecords(source.data(), target.data(), source.size(), 0x10);
+    REQUIRE(records.size() == 2);
+    REQUIRE(records[0].offset == 0x12);
+    REQUIRE(records[1].data == std::vector<uint8_t>{9});
+
+    auto ips = makeIpsPatch(records);
+    REQUIRE(ips == std::vector<uint8_t>{'P', 'A', 'T', 'C', 'H', 0x00, 0x00, 0x12, 0x00, 0x02, 9, 9,
+                                        0x00, 0x00, 0x17, 0x00, 0x01, 9,    'E',  'O',  'F'});
+
+    auto bps = makeBpsPatch(records, 0x218, 0x200, 0, 0x18, 0);
+    REQUIRE(bps.size() > 16);
+    REQUIRE(std::string(bps.begin(), bps.begin() + 4) == "BPS1");
+    REQUIRE(patchFormat("fix.BPS") == sfcPatchFormat::bps);
+
+    // Copy offsets moved outside the source (here one byte before it) are rejected rather than wrapped around
+    sfcImageBuilder builder(source.size(), true);
+    builder.append(source.data(), source.size());
+    sfcImage image = builder.finish();
+    std::vector<uint8_t> corrupt = {'B', 'P', 'S', '1', 0x88, 0x88, 0x80, 0x82, 0x83};
+    auto putLong = [&](uint32_t value) {
+        for (int shift = 0; shift < 32; shift += 8) {
+            corrupt.push_back((uint8_t)(value >> shift));
+        }
+    };
+    putLong(crc32(source.data(), source.size()));
+    putLong(0);
+    putLong(crc32(corrupt.data(), corrupt.size()));
+    REQUIRE(applyPatch(corrupt, image) == "BPS patch is corrupt");
+    REQUIRE(patchFormat("fix.sfc") == sfcPatchFormat::none);
+}
+
+TEST_CASE("sfcRom.patch") {
+    // Patches written for a headered file apply to it again: IPS to the image without copier header, BPS to the
+    // whole file, removing the copier header as fixing does
+    std::ifstream file(rom1, std::ios::binary);
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    auto headeredPath = (std::filesystem::temp_directory_path() / "superfamicheck-rom1.smc").string();
+    {
+        std::ofstream headered(headeredPath, std::ios::binary);
+        headered.write(std::string(0x200, '\0').data(), 0x200);
+        headered.write((const char*)bytes.data(), bytes.size());
+    }
+
+    for (auto romPath : {rom1, headeredPath.c_str()}) {
+        for (auto ext : {".ips", ".bps"}) {
+            auto patchPath = (std::filesystem::temp_directory_path() / "superfamicheck-rom1").string() + ext;
+            sfcRom rom(romPath);
+            REQUIRE(rom.hasCorrectChecksum == false);
+            REQUIRE(rom.fix(patchPath, true).empty());
+
+            sfcRom patched(romPath, {.patchPath = patchPath});
+            REQUIRE(patched.error.empty());
+            REQUIRE(patched.isPatched == true);
+            REQUIRE(patched.hasCorrectChecksum == true);
+            REQUIRE(patched.hasCopierHeader == (romPath == headeredPath && std::string(ext) == ".ips"));
+            std::filesystem::remove(patchPath);
+        }
+    }
+    std::filesystem::remove(headeredPath);
+
+    sfcRom missing(rom1, {.patchPath = "data/public/missing.bps"});
+    REQUIRE(missing.isValid == false);
+    REQUIRE(!missing.error.empty());
+}
+
+TEST_CASE("findParts") {
+    auto directory = std::filesystem::temp_directory_path() / "superfamicheck-parts";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    for (auto name : {"h.1", "h.2", "g.01", "g.02", "g.03", "romA.078", "romB.078"}) {
+        std::ofstream((directory / name).string()) << "part";
+    }
+    auto parts = [&](const std::string& name) {
+        std::vector<std::string> found;
+        for (const auto& part : findParts((directory / name).string())) {
+            found.push_back(std::filesystem::path(part).filename().string());
+        }
+        return found;
+    };
+    REQUIRE(parts("h.1") == std::vector<std::string>{"h.1", "h.2"});
+    REQUIRE(parts("g.01") == std::vector<std::string>{"g.01", "g.02", "g.03"});
+    REQUIRE(parts("romA.078") == std::vector<std::string>{"romA.078", "romB.078"});
+    REQUIRE(parts("x.99999999999") == std::vector<std::string>{"x.99999999999"});
+    std::filesystem::remove_all(directory);
+
+    sfcRom none(std::vector<std::string>{});
+    REQUIRE(none.isValid == false);
+}
+
+TEST_CASE("sfcRom.overdump") {
+    std::ifstream file(rom1, std::ios::binary);
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    auto overdumpPath = (std::filesystem::temp_directory_path() / "superfamicheck-overdump.sfc").string();
+    {
+        std::ofstream overdump(overdumpPath, std::ios::binary);
+        overdump.write((const char*)bytes.data(), bytes.size());
+        overdump.write((const char*)bytes.data(), bytes.size());
+    }
+
+    sfcRom rom(overdumpPath);
+    REQUIRE(rom.imageSize == bytes.size() * 2);
+    REQUIRE(rom.realSize == bytes.size());
+    REQUIRE(rom.hasIssues == true);
+    rom.fix(overdumpPath, true);
+    REQUIRE(std::filesystem::file_size(overdumpPath) == bytes.size());
+
+    sfcRom fixed(overdumpPath);
+    REQUIRE(fixed.hasCorrectChecksum == true);
+    REQUIRE(fixed.realSize == fixed.imageSize);
+    std::filesystem::remove(overdumpPath);
+
+    // Without the bytes, a mirror is only taken as one when bank CRCs match too, not just the sums
+    std::vector<uint8_t> doubled = bytes;
+    doubled.insert(doubled.end(), bytes.begin(), bytes.end());
+    REQUIRE(sfcRom(doubled).realSize == bytes.size());
+    size_t swap = std::adjacent_find(bytes.begin(), bytes.end(), std::not_equal_to<>()) - bytes.begin();
+    std::swap(doubled[bytes.size() + swap], doubled[bytes.size() + swap + 1]);
+    sfcRom sameSums(doubled);
+    REQUIRE(sameSums.realSize == doubled.size());
+}
+
+TEST_CASE("dropPages") {
+    // Reading without keeping the cache leaves pages that were cached before alone
+    std::string error;
+    readFile(rom1, false, error, true);
+    sfcFile file(rom1);
+    auto cached = residentPages(file.fd, file.size());
+    if (cached.empty()) { return; }
+    REQUIRE(std::all_of(cached.begin(), cached.end(), [](uint8_t page) { return page & 1; }));
+    REQUIRE(readFile(rom1, false, error, false).size() == 0x8000);
+    auto after = residentPages(file.fd, file.size());
+    REQUIRE(std::all_of(after.begin(), after.end(), [](uint8_t page) { return page & 1; }));
+}
+
+TEST_CASE("sfcImageBuilder") {
+    std::ifstream file(rom1, std::ios::binary);
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    sfcRom rom(rom1);
+
+    for (bool retain : {true, false}) {
+        sfcImageBuilder builder(bytes.size(), retain);
+        for (size_t offset = 0; offset < bytes.size(); offset += 0x1234) {
+            builder.append(&bytes[offset], std::min<size_t>(0x1234, bytes.size() - offset));
+        }
+        REQUIRE(builder.complete());
+        REQUIRE(builder.crc == crc32(bytes.data(), bytes.size()));
+
+        sfcImage image = builder.finish();
+        REQUIRE(image.bankCrcs == (retain ? std::vector<uint32_t>() : std::vector<uint32_t>{builder.crc}));
+        sfcRom streamed("rom1", std::move(image));
+        REQUIRE(streamed.isValid == true);
+        REQUIRE(streamed.headerLocation == rom.headerLocation);
+        REQUIRE(streamed.correctedChecksum == rom.correctedChecksum);
+    }
+}
+
+TEST_CASE("sfcRom.span") {
+    std::ifstream file(rom1, std::ios::binary);
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    sfcRom rom(rom1);
+
+    sfcRom checked(bytes, "rom1");
+    REQUIRE(checked.isValid == true);
+    REQUIRE(checked.headerLocation == rom.headerLocation);
+    REQUIRE(checked.correctedChecksum == rom.correctedChecksum);
+    REQUIRE(checked.hasCorrectChecksum == false);
+
+    REQUIRE(!checked.fix(std::span<uint8_t>(bytes).first(bytes.size() / 2), true).empty());
+    REQUIRE(checked.fix(bytes, true).empty());
+    sfcRom fixed(bytes, "rom1");
+    REQUIRE(fixed.hasCorrectChecksum == true);
+    REQUIRE(fixed.hasIssues == false);
+}
+
+TEST_CASE("sfcImage.deinterleave") {
+    for (bool retain : {true, false}) {
+        sfcImageBuilder builder(0x200000, retain);
+        for (size_t block = 0; block < 0x40; ++block) {
+            std::vector<uint8_t> bytes(sfcBankSize, (uint8_t)block);
+            builder.append(bytes.data(), bytes.size());
+        }
+        sfcImage image = builder.finish();
+        image.deinterleave();
+
+        // Each bank held its own index before interleaving, header windows move along when not retained
+        for (size_t block = 0; block < 0x40; ++block) {
+            size_t expected = block & 1 ? block >> 1 : 0x20 + (block >> 1);
+            REQUIRE(image.bankSums[block] == sfcBankSize * expected);
+            if (retain || expected < 2) { REQUIRE(image[block * sfcBankSize + 0x1234] == expected); }
+        }
+    }
+}
+
+TEST_CASE("sfcResult") {
+    sfcRom rom(rom1);
+    sfcResult result = makeResult("dir/rom \"1\".sfc", rom, rom.description(false) + "\ttab \x01");
+    for (auto format : {sfcResultFormat::ndjson, sfcResultFormat::binary}) {
+        std::string file = resultsHeader(format) + encodeResult(result, format) + encodeResult(result, format);
+        std::vector<sfcResult> decoded;
+        REQUIRE(decodeResults(file, decoded).empty());
+        REQUIRE(decoded.size() == 2);
+        REQUIRE(decoded[1].name == result.name);
+        REQUIRE(decoded[1].report == result.report);
+        REQUIRE(decoded[1].correctedChecksum == rom.correctedChecksum);
+        REQUIRE(decoded[1].isValid == rom.isValid);
+
+        // A record cut short is reported, the ones before it are kept
+        decoded.clear();
+        REQUIRE(!decodeResults(file.substr(0, file.size() - 3), decoded).empty());
+        REQUIRE(decoded.size() == 1);
+    }
+    REQUIRE(resultFormat("shard1.ndjson") == sfcResultFormat::ndjson);
+    REQUIRE(resultFormat("shard1.bin") == sfcResultFormat::binary);
+
+    // Resuming keeps what an earlier run checkpointed, a fresh start forgets it
+    auto checkpointPath = (std::filesystem::temp_directory_path() / "superfamicheck-checkpoint.bin").string();
+    {
+        sfcCheckpoint checkpoint;
+        REQUIRE(checkpoint.open(checkpointPath, false).empty());
+        checkpoint.add(result);
+    }
+    {
+        sfcCheckpoint checkpoint;
+        REQUIRE(checkpoint.open(checkpointPath, true).empty());
+        REQUIRE(checkpoint.find(result.name) != nullptr);
+        REQUIRE(checkpoint.find(result.name)->report == result.report);
+    }
+    {
+        sfcCheckpoint checkpoint;
+        REQUIRE(checkpoint.open(checkpointPath, false).empty());
+        REQUIRE(checkpoint.find(result.name) == nullptr);
+    }
+    std::filesystem::remove(checkpointPath);
+}
+
+#ifndef _WIN32
+TEST_CASE("sfcRing") {
+    sfcRom rom(rom1);
+    sfcRingRecord record = makeRingRecord(std::string(300, 'x') + "/rom1.sfc", rom);
+    REQUIRE((record.flags & sfcRingValid) != 0);
+    REQUIRE(record.correctedChecksum == rom.correctedChecksum);
+    REQUIRE(std::string(record.name).size() == sizeof(record.name) - 1);
+    REQUIRE(std::string(record.name).ends_with("/rom1.sfc"));
+
+    sfcRingWriter writer;
+    REQUIRE(writer.open("/superfamicheck-test", 4).empty());
+    sfcRingReader reader;
+    REQUIRE(reader.open("/superfamicheck-test").empty());
+
+    // A reader a whole ring behind gets the latest records and counts the ones it missed
+    for (int i = 0; i < 6; ++i) {
+        record.imageSize = i;
+        writer.publish(record);
+    }
+    sfcRingRecord read;
+    for (uint64_t i = 2; i < 6; ++i) {
+        REQUIRE(reader.next(read));
+        REQUIRE(read.imageSize == i);
+    }
+    REQUIRE(!reader.next(read));
+    REQUIRE(reader.missed == 2);
+
+    // Records are read in place, a reader from the latest only sees what comes after it
+    sfcRingReader latest;
+    REQUIRE(latest.open("/superfamicheck-test", true).empty());
+    REQUIRE(latest.peek() == nullptr);
+    record.imageSize = 6;
+    writer.publish(record);
+    const sfcRingRecord* current = latest.peek();
+    REQUIRE(current != nullptr);
+    REQUIRE(current->imageSize == 6);
+    REQUIRE(latest.advance());
+    REQUIRE(reader.next(read));
+    REQUIRE(read.correctedChecksum == rom.correctedChecksum);
+    shm_unlink("/superfamicheck-test");
+}
+#endif
+
+TEST_CASE("sfcTasks") {
+    sfcTaskPool pool(4);
+
+    // Nested groups, with waiting threads running other tasks meanwhile
+    std::atomic<size_t> leaves = 0;
+    std::function<void(int)> split = [&](int depth) {
+        if (depth == 0) {
+            ++leaves;
+            return;
+        }
+        sfcTaskGroup halves;
+        halves.run([&, depth] { split(depth - 1); });
+        halves.run([&, depth] { split(depth - 1); });
+    };
+    sfcTaskGroup root(&pool);
+    root.run([&] { split(10); });
+    root.wait();
+    REQUIRE(leaves == 1024);
+
+    // Bank sums taken in chunks on the pool match those taken on one thread
+    sfcImage image;
+    image.data.resize(0x500000);
+    for (size_t i = 0; i < image.data.size(); ++i) {
+        image.data[i] = (uint8_t)(i * 7 + (i >> 12));
+    }
+    image.length = image.data.size();
+    image.sumBanks();
+    std::vector<uint32_t> sequential = image.bankSums;
+    sfcTaskGroup summing(&pool);
+    summing.run([&] { image.sumBanks(); });
+    summing.wait();
+    REQUIRE(image.bankSums == sequential);
+}
+
+TEST_CASE("runBatch") {
+    // A directory with rom1 as is and stored in a zip archive, which has to reach the task unread
+    std::ifstream file(rom1, std::ios::binary);
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    auto directory = std::filesystem::temp_directory_path() / "superfamicheck-batch";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    std::filesystem::copy_file(rom1, directory / "rom1.sfc");
+
+    const std::string member = "rom1.sfc";
+    uint32_t crc = crc32(bytes.data(), bytes.size());
+    std::vector<uint8_t> zip;
+    auto put = [&](uint32_t value, int length) {
+        for (int i = 0; i < length; ++i) {
+            zip.push_back((uint8_t)(value >> (i * 8)));
+        }
+    };
+    put(0x04034b50, 4), put(10, 2), put(0, 2), put(0, 2), put(0, 4), put(crc, 4);
+    put((uint32_t)bytes.size(), 4), put((uint32_t)bytes.size(), 4), put((uint32_t)member.size(), 2), put(0, 2);
+    zip.insert(zip.end(), member.begin(), member.end());
+    zip.insert(zip.end(), bytes.begin(), bytes.end());
+    size_t directoryOffset = zip.size();
+    put(0x02014b50, 4), put(10, 2), put(10, 2), put(0, 2), put(0, 2), put(0, 4), put(crc, 4);
+    put((uint32_t)bytes.size(), 4), put((uint32_t)bytes.size(), 4), put((uint32_t)member.size(), 2);
+    put(0, 2), put(0, 2), put(0, 2), put(0, 2), put(0, 4), put(0, 4);
+    zip.insert(zip.end(), member.begin(), member.end());
+    size_t directorySize = zip.size() - directoryOffset;
+    put(0x06054b50, 4), put(0, 2), put(0, 2), put(1, 2), put(1, 2);
+    put((uint32_t)directorySize, 4), put((uint32_t)directoryOffset, 4), put(0, 2);
+    std::ofstream((directory / "rom1.zip").string(), std::ios::binary).write((const char*)zip.data(), zip.size());
+
+    auto paths = findImages({directory.string()});
+    REQUIRE(paths.size() == 2);
+    for (unsigned jobs : {1u, 4u}) {
+        sfcTaskPool pool(jobs);
+        std::vector<sfcResult> results;
+        auto task = [](const std::string& path, sfcBytes&& content, bool stream) {
+            sfcRom rom = content.empty() ? sfcRom(path, sfcReadOptions()) : sfcRom(path, readBytes(std::move(content), !stream));
+            return makeResult(path, rom, std::string());
+        };
+        runBatch(paths, pool, sfcBatchOptions(), task, [&](const sfcResult& result) { results.push_back(result); });
+        REQUIRE(results.size() == 2);
+        for (const auto& result : results) {
+            REQUIRE(result.isValid == true);
+            REQUIRE(result.correctedChecksum == sfcRom(rom1).correctedChecksum);
+        }
+    }
+
+    // Fixing in place leaves the archive alone and says so
+    sfcTaskPool pool(1);
+    auto fixTask = [](const std::string& path, sfcBytes&& content, bool stream) {
+        sfcRom rom = content.empty() ? sfcRom(path, sfcReadOptions()) : sfcRom(path, readBytes(std::move(content), !stream));
+        return makeResult(path, rom, rom.fix(path, true));
+    };
+    std::vector<sfcResult> fixed;
+    runBatch({(directory / "rom1.zip").string()}, pool, sfcBatchOptions(), fixTask, [&](const sfcResult& result) {
+        fixed.push_back(result);
+    });
+    REQUIRE(fixed.size() == 1);
+    REQUIRE(fixed[0].report.find("in place") != std::string::npos);
+    REQUIRE(std::filesystem::file_size(directory / "rom1.zip") == zip.size());
+    REQUIRE(sfcRom((directory / "rom1.zip").string()).isValid == true);
+    std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("sfcRateLimiter") {
+    // Reads turned down after the rate allowed them (eg. for lack of memory) aren't charged, however often they're tried
+    sfcRateLimiter limiter(1000);
+    for (int i = 0; i < 100; ++i) {
+        REQUIRE(limiter.take(600, false, [] { return false; }) == false);
+    }
+    REQUIRE(limiter.available() == 1000);
+    REQUIRE(limiter.take(600, false, [] { return true; }) == true);
+    REQUIRE(limiter.available() <= 400.5);
+    REQUIRE(limiter.take(600, false) == true);
+    REQUIRE(limiter.take(600, false) == false);
+    REQUIRE(limiter.available() < 0);
+}
+
+#ifdef __linux__
+TEST_CASE("sfcWatch") {
+    auto directory = std::filesystem::temp_directory_path() / "superfamicheck-watch";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    auto image = (directory / "a.sfc").string();
+    auto other = (directory / "sub" / "b.smc").string();
+
+    sfcWatch watch;
+    REQUIRE(watch.open(directory.string()).empty());
+
+    // Several writes to an image are reported once, other files not at all
+    for (int i = 0; i < 3; ++i) {
+        std::ofstream(image, std::ios::app) << "a";
+    }
+    std::ofstream((directory / "notes.txt").string()) << "b";
+    REQUIRE(watch.next() == std::vector<std::string>{image});
+
+    // Images in new directories are found, reopening a handled image without changing it isn't a write
+    watch.handled(image);
+    std::ofstream(image, std::ios::app).flush();
+    std::filesystem::create_directories(directory / "sub");
+    std::ofstream(other) << "b";
+    REQUIRE(watch.next() == std::vector<std::string>{other});
+
+    std::ofstream(image, std::ios::app) << "a";
+    REQUIRE(watch.next() == std::vector<std::string>{image});
+    std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("serve") {
+    auto socketPath = (std::filesystem::temp_directory_path() / "superfamicheck-serve.sock").string();
+    std::filesystem::remove(socketPath);
+    sfcTaskPool pool(2);
+    int stop[2];
+    REQUIRE(::pipe(stop) == 0);
+    std::string error = "running";
+    std::thread server([&] {
+        error = serve(socketPath, pool, [](const std::string& name, sfcRom& rom) { return makeResult(name, rom, ""); }, stop[0]);
+    });
+
+    auto connect = [&] {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        socketPath.copy(address.sun_path, sizeof(address.sun_path) - 1);
+        int client = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        for (int tries = 0; ::connect(client, (sockaddr*)&address, sizeof(address)) != 0 && tries < 500; ++tries) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return client;
+    };
+    // Reply lines up to the next count newlines, or what came before the server hung up
+    auto replies = [](int client, int count) {
+        std::string reply;
+        char data[0x1000];
+        while (std::count(reply.begin(), reply.end(), '\n') < count) {
+            ssize_t length = ::recv(client, data, sizeof(data), 0);
+            if (length <= 0) { break; }
+            reply.append(data, (size_t)length);
+        }
+        return reply;
+    };
+    auto isValid = [](const std::string& name, bool valid) {
+        return "{\"name\":\"" + name + "\",\"valid\":" + (valid ? "true" : "false");
+    };
+
+    // Two requests sent at once are answered in order, the image named by its path
+    int client = connect();
+    std::string pipelined = std::string("json ") + rom1 + "\njson " + rom0 + "\n";
+    REQUIRE(::send(client, pipelined.data(), pipelined.size(), 0) == (ssize_t)pipelined.size());
+    std::string reply = replies(client, 2);
+    REQUIRE(reply.starts_with(isValid(rom1, true)));
+    REQUIRE(reply.find("\n" + isValid(rom0, false)) != std::string::npos);
+
+    // A file passed along is read from its descriptor, the path only names it
+    int file = ::open(rom1, O_RDONLY);
+    std::string request = "json passed.sfc\n";
+    iovec chunk = {request.data(), request.size()};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr message = {};
+    message.msg_iov = &chunk;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(header), &file, sizeof(int));
+    REQUIRE(::sendmsg(client, &message, 0) == (ssize_t)request.size());
+    ::close(file);
+    REQUIRE(replies(client, 1).starts_with(isValid("passed.sfc", true)));
+
+    // A malformed request is reported and ends the connection
+    REQUIRE(::send(client, "check rom1\n", 11, 0) == 11);
+    reply = replies(client, 2);
+    REQUIRE(reply.find("Invalid request \\\"check rom1\\\"") != std::string::npos);
+    REQUIRE(std::count(reply.begin(), reply.end(), '\n') == 1);
+    ::close(client);
+
+    ::close(stop[1]);
+    server.join();
+    ::close(stop[0]);
+    REQUIRE(error.empty());
+    std::filesystem::remove(socketPath);
+}
+#endif
+
+#ifdef SFC_HAVE_ZSTD
+TEST_CASE("sfcZstd") {
+    auto zstPath = (std::filesystem::temp_directory_path() / "superfamicheck-rom1.zst").string();
+    auto sfcPath = (std::filesystem::temp_directory_path() / "superfamicheck-rom1.sfc").string();
+    REQUIRE(convertImage(rom1, zstPath).empty());
+    REQUIRE(convertImage(zstPath, sfcPath).empty());
+
+    sfcRom rom(rom1);
+    for (bool quick : {false, true}) {
+        sfcRom compressed(zstPath, {.retainImage = false, .quick = quick});
+        REQUIRE(compressed.isValid == true);
+        REQUIRE(compressed.correctedChecksum == rom.correctedChecksum);
+    }
+
+    // Corrupt seek tables and indexes are reported, not trusted (or allocated for)
+    std::ifstream file(zstPath, std::ios::binary);
+    std::vector<uint8_t> container((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    file.close();
+    const std::vector<uint8_t> indexMagic = {0x5f, 0x2a, 0x4d, 0x18};
+    size_t index = std::search(container.begin(), container.end(), indexMagic.begin(), indexMagic.end()) - container.begin();
+    REQUIRE(index < container.size());
+    auto corrupt = [&](size_t offset, uint32_t value) {
+        auto bytes = container;
+        for (size_t i = 0; i < 4; ++i) {
+            bytes[offset + i] = (uint8_t)(value >> (i * 8));
+        }
+        std::ofstream(zstPath, std::ios::binary | std::ios::trunc).write((const char*)bytes.data(), bytes.size());
+        std::string error;
+        readZstd(zstPath, false, true, error);
+        return error;
+    };
+    REQUIRE(corrupt(container.size() - 9, 0xffffffff) == "Seek table of zstd image is corrupt");
+    for (uint32_t indexSize : {0u, 16u, 26u, 28u, 0xfffffff0u}) {
+        REQUIRE(corrupt(index + 4, indexSize) == "Index of zstd image is corrupt");
+    }
+    REQUIRE(corrupt(index + 4, 24).empty());
+
+    std::filesystem::remove(zstPath);
+    std::filesystem::remove(sfcPath);
+}
+#endif